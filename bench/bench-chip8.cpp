@@ -0,0 +1,213 @@
+#include "chip8.hpp"
+#include "lockstep_chip8.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Every benchmark runs a fixed number of instructions of a ROM per
+// iteration. Pass --benchmark_format=json for the machine
+// readable report, the counters below end up in it next to the timings
+
+static constexpr std::size_t micro_cycles = 1'000;
+static constexpr std::size_t macro_cycles = 100'000;
+
+// Inverting the rate of instructions / 1e9 gives ns per instruction
+static void set_counters(benchmark::State &state, const double instructions) {
+  state.counters["instructions_per_second"] =
+      benchmark::Counter(instructions, benchmark::Counter::kIsRate);
+  state.counters["ns_per_instruction"] = benchmark::Counter(
+      instructions / 1e9,
+      benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+static void run_rom(benchmark::State &state, const std::vector<uint8_t> &rom,
+                    const backend engine, const std::size_t cycles) {
+  chip8 emulator{engine};
+  emulator.load_memory(rom);
+  for (auto _ : state) {
+    emulator.run(cycles);
+  }
+  if (emulator.get_fault() != fault::none) {
+    state.SkipWithError("the ROM faulted");
+  }
+  set_counters(state, static_cast<double>(cycles) *
+                          static_cast<double>(state.iterations()));
+}
+
+static void micro(benchmark::State &state, const std::vector<uint8_t> &rom,
+                  const backend engine) {
+  run_rom(state, rom, engine, micro_cycles);
+}
+
+// One of the public-domain ROMs in bench/roms, empty when it is missing
+static std::vector<uint8_t> bundled_rom(const std::string &rom_name) {
+  std::ifstream file(std::string{CHIP8_BENCH_ROMS} + "/" + rom_name,
+                     std::ios::binary);
+  return {std::istreambuf_iterator<char>(file),
+          std::istreambuf_iterator<char>()};
+}
+
+// Every iteration runs a bundled ROM from power on
+static void macro(benchmark::State &state, const std::string &rom_name,
+                  const backend engine, const std::size_t cycles) {
+  const auto rom = bundled_rom(rom_name);
+  if (rom.empty()) {
+    state.SkipWithError("the ROM is missing from bench/roms");
+    return;
+  }
+  chip8 emulator{engine};
+  emulator.load_memory(rom);
+  for (auto _ : state) {
+    emulator.reset();
+    emulator.run(cycles);
+  }
+  if (emulator.get_fault() != fault::none) {
+    state.SkipWithError("the ROM faulted");
+  }
+  set_counters(state, static_cast<double>(cycles) *
+                          static_cast<double>(state.iterations()));
+}
+
+// Micro benchmarks, one opcode class each followed by a jump back to 0x200
+
+// 8XYn: add, or, and, xor, sub, shifts
+static const std::vector<uint8_t> alu_rom{
+    0x80, 0x14, 0x81, 0x25, 0x82, 0x36, 0x83, 0x47, 0x84,
+    0x51, 0x85, 0x62, 0x86, 0x73, 0x87, 0x0E, 0x12, 0x00};
+
+// DXYN: font sprites, the second pair is clipped at the right edge
+static const std::vector<uint8_t> draw_rom{
+    0xA0, 0x00, 0x60, 0x05, 0x61, 0x03, 0xD0, 0x15, 0xD0,
+    0x15, 0x60, 0x3C, 0xD0, 0x15, 0xD0, 0x15, 0x12, 0x00};
+
+// FX55 / FX65: all sixteen registers to 0x300 and back
+static const std::vector<uint8_t> memory_copy_rom{
+    0xA3, 0x00, 0xFF, 0x55, 0xFF, 0x65, 0xA3, 0x00, 0xFF,
+    0x55, 0xFF, 0x65, 0x12, 0x00};
+
+// CXNN
+static const std::vector<uint8_t> rng_rom{
+    0xC0, 0xFF, 0xC1, 0xFF, 0xC2, 0x0F, 0xC3, 0xF0, 0x12, 0x00};
+
+// 2NNN / 00EE: two calls of the return at 0x206
+static const std::vector<uint8_t> call_ret_rom{
+    0x22, 0x06, 0x22, 0x06, 0x12, 0x00, 0x00, 0xEE};
+
+// Decoding alone, the nested switch that decode_table replaced against
+// the table. The opcodes are a mix of ALU, draw, copy and call code
+static std::vector<uint16_t> decoder_mix() {
+  std::vector<uint16_t> opcodes;
+  for (const auto *rom : {&alu_rom, &draw_rom, &memory_copy_rom, &rng_rom,
+                          &call_ret_rom}) {
+    for (std::size_t addr = 0; addr + 1 < rom->size(); addr += 2) {
+      opcodes.push_back(
+          static_cast<uint16_t>(((*rom)[addr] << 8) | (*rom)[addr + 1]));
+    }
+  }
+  return opcodes;
+}
+
+static void decode_switch(benchmark::State &state) {
+  const auto opcodes = decoder_mix();
+  for (auto _ : state) {
+    for (const auto opcode : opcodes) {
+      benchmark::DoNotOptimize(decode(opcode));
+    }
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(opcodes.size()) *
+                          static_cast<int64_t>(state.iterations()));
+}
+
+static void decode_lookup(benchmark::State &state) {
+  const auto opcodes = decoder_mix();
+  for (auto _ : state) {
+    for (const auto opcode : opcodes) {
+      benchmark::DoNotOptimize(lookup(opcode));
+    }
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(opcodes.size()) *
+                          static_cast<int64_t>(state.iterations()));
+}
+
+// The same ROM on 16 machines, one after the other or in lockstep lanes.
+// instructions_per_second counts the instructions of all of them
+static constexpr std::size_t batch_lanes = 16;
+static const auto counter_rom = bundled_rom("counter.ch8");
+
+static void batch_separate(benchmark::State &state,
+                           const std::vector<uint8_t> &rom) {
+  if (rom.empty()) {
+    state.SkipWithError("the ROM is missing from bench/roms");
+    return;
+  }
+  std::vector<chip8> machines(batch_lanes);
+  for (auto &machine : machines) {
+    machine.load_memory(rom);
+  }
+  for (auto _ : state) {
+    for (auto &machine : machines) {
+      machine.run(micro_cycles);
+    }
+  }
+  set_counters(state, static_cast<double>(micro_cycles * batch_lanes) *
+                          static_cast<double>(state.iterations()));
+}
+
+static void batch_lockstep(benchmark::State &state,
+                           const std::vector<uint8_t> &rom) {
+  if (rom.empty()) {
+    state.SkipWithError("the ROM is missing from bench/roms");
+    return;
+  }
+  auto lanes = std::make_unique<lockstep_chip8<batch_lanes>>();
+  lanes->load_memory(rom);
+  for (auto _ : state) {
+    lanes->run(micro_cycles);
+  }
+  set_counters(state, static_cast<double>(micro_cycles * batch_lanes) *
+                          static_cast<double>(state.iterations()));
+}
+
+BENCHMARK_CAPTURE(micro, alu/interpreter, alu_rom, backend::interpreter);
+BENCHMARK_CAPTURE(micro, alu/threaded, alu_rom, backend::threaded);
+BENCHMARK_CAPTURE(micro, draw/interpreter, draw_rom, backend::interpreter);
+BENCHMARK_CAPTURE(micro, draw/threaded, draw_rom, backend::threaded);
+BENCHMARK_CAPTURE(micro, memory_copy/interpreter, memory_copy_rom,
+                  backend::interpreter);
+BENCHMARK_CAPTURE(micro, memory_copy/threaded, memory_copy_rom,
+                  backend::threaded);
+BENCHMARK_CAPTURE(micro, rng/interpreter, rng_rom, backend::interpreter);
+BENCHMARK_CAPTURE(micro, rng/threaded, rng_rom, backend::threaded);
+BENCHMARK_CAPTURE(micro, call_ret/interpreter, call_ret_rom,
+                  backend::interpreter);
+BENCHMARK_CAPTURE(micro, call_ret/threaded, call_ret_rom, backend::threaded);
+
+BENCHMARK(decode_switch);
+BENCHMARK(decode_lookup);
+
+// Maze stops drawing after 992 instructions, see bench/roms/README.md
+BENCHMARK_CAPTURE(macro, maze/interpreter, "maze.ch8", backend::interpreter,
+                  992);
+BENCHMARK_CAPTURE(macro, maze/threaded, "maze.ch8", backend::threaded, 992);
+BENCHMARK_CAPTURE(macro, counter/interpreter, "counter.ch8",
+                  backend::interpreter, macro_cycles);
+BENCHMARK_CAPTURE(macro, counter/threaded, "counter.ch8", backend::threaded,
+                  macro_cycles);
+BENCHMARK_CAPTURE(macro, bounce/interpreter, "bounce.ch8",
+                  backend::interpreter, macro_cycles);
+BENCHMARK_CAPTURE(macro, bounce/threaded, "bounce.ch8", backend::threaded,
+                  macro_cycles);
+
+BENCHMARK_CAPTURE(batch_separate, alu, alu_rom);
+BENCHMARK_CAPTURE(batch_lockstep, alu, alu_rom);
+BENCHMARK_CAPTURE(batch_separate, counter, counter_rom);
+BENCHMARK_CAPTURE(batch_lockstep, counter, counter_rom);
+
+BENCHMARK_MAIN();
@@ -2,53 +2,274 @@
 #define CHIP_8_H_
 
 #include <array>
+#include <chrono>
 #include <cstdint>
 #include <memory>
 #include <stack>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "decoder.hpp"
 #include "keyboard.hpp"
+#include "profile.hpp"
 
 static constexpr auto display_x = 64;
 static constexpr auto display_y = 32;
 static constexpr auto display_size = display_x * display_y;
+static constexpr uint16_t prog_mem_begin = 512;
+// A ROM fills at most the memory above the interpreter area
+static constexpr std::size_t max_rom_size = 4096 - prog_mem_begin;
+// The delay and sound timers always run at 60 Hz, the instruction clock
+// is configurable
+static constexpr uint32_t timer_hz = 60;
+static constexpr uint32_t default_clock_hz = 600;
+// CXNN is reproducible unless the frontend seeds it differently
+static constexpr uint32_t default_rng_seed = 0x2545F491;
+
+// Nesting depth of subroutine calls. 16 matches CHIP8 and SCHIP, the build
+// can raise it (CHIP8_STACK_DEPTH) for extensions such as XO-CHIP
+#ifndef CHIP8_STACK_DEPTH
+#define CHIP8_STACK_DEPTH 16
+#endif
+static constexpr std::size_t stack_depth = CHIP8_STACK_DEPTH;
+static_assert(stack_depth > 0 && stack_depth <= 255,
+              "the stack pointer is a single byte");
+
+// Errors raised by the ROM itself. The machine halts on the faulting
+// instruction until it is reset or reloaded
+enum class fault : uint8_t { none, stack_overflow, stack_underflow };
+// Instruction tracing for the debugger windows. Release (NDEBUG) builds
+// compile every trace path away
+#ifdef NDEBUG
+static constexpr bool debug = false;
+#else
 static constexpr bool debug = true;
+#endif
+
+// One executed instruction as seen by the debugger
+struct trace_record {
+  uint16_t prog_counter;
+  uint16_t opcode;
+};
+
+// interpreter: fetch, decode and execute one instruction at a time
+// threaded: translate straight-line code into blocks of pre-bound
+//           handlers once, and run a whole block per dispatch
+enum class backend { interpreter, threaded };
+
+// The emulated machine itself, without any of the host-side helpers
+// (decode caches, trace, keyboard) that chip8 keeps next to it
+struct chip8_state {
+  std::array<uint8_t, 4096> memory{0};
+  std::array<uint8_t, 16> V{0};
+  std::array<uint16_t, stack_depth> hw_stack{0};
+  uint8_t stack_pointer{0};
+  // One bit per pixel, the leftmost pixel of a row is its MSB
+  std::array<uint64_t, display_y> display{0};
+  uint16_t I{0};
+  uint16_t prog_counter{prog_mem_begin};
+  uint8_t delay_timer{0};
+  uint8_t sound_timer{0};
+  // Emulated time since the last timer tick, in 1/(timer_hz * clock_hz)
+  // of a second
+  uint32_t timer_phase{0};
+  // Bit n set while key n is held
+  uint16_t keys{0};
+  // State of the CXNN random number generator
+  uint32_t rng{default_rng_seed};
+  fault error{fault::none};
+};
+static_assert(std::is_trivially_copyable_v<chip8_state>,
+              "chip8_state is snapshotted with plain copies");
+
+// save_state writes this header followed by the raw bytes of chip8_state,
+// so a snapshot only loads into a build with the same state layout
+static constexpr uint32_t snapshot_magic = 0x54533843; // "C8ST"
+static constexpr uint16_t snapshot_version = 1;
+struct snapshot_header {
+  uint32_t magic{0};
+  uint16_t version{0};
+  uint16_t reserved{0};
+  uint32_t state_size{0};
+};
+static constexpr std::size_t snapshot_size =
+    sizeof(snapshot_header) + sizeof(chip8_state);
+
+constexpr bool is_pixel_set(const chip8_state &state, const std::size_t x,
+                            const std::size_t y) noexcept {
+  return ((state.display[y] >> (display_x - 1 - x)) & 1U) != 0;
+}
 
 class chip8 {
 public:
   chip8();
+  explicit chip8(backend selected);
   explicit chip8(std::unique_ptr<keyboard> keyPtr);
+  chip8(std::unique_ptr<keyboard> keyPtr, backend selected);
+  // ROMs larger than max_rom_size throw std::length_error. Loading moves
+  // the program counter back to the ROM and clears the stack and any
+  // fault, the rest of the machine (registers, display, timers) is kept
+  void load_memory(const uint8_t *rom, std::size_t size);
   void load_memory(const std::vector<uint8_t> &rom_opcodes);
   void load_memory(const std::string &file_name);
+  // Same as load_memory, but keeps pointing at the image instead of
+  // copying it for reset(), so it is copied once, into memory. The image
+  // must stay valid until the next load or the machine is destroyed
+  void load_mapped(const uint8_t *rom, std::size_t size);
+  // Back to power on with the last loaded ROM and RNG seed
   void reset();
+  // Allocation free snapshots, see snapshot_header. save_state needs
+  // snapshot_size bytes and returns the number written
+  std::size_t save_state(uint8_t *buffer, std::size_t size) const;
+  void load_state(const uint8_t *buffer, std::size_t size);
+  // Fastest path, a snapshot is just a copy of get_state()
+  void load_state(const chip8_state &snapshot);
   void step_one_cycle();
+  // Keypad input from the frontend, bit n is key n. Ignored when a
+  // keyboard was passed to the constructor
+  void set_keys(uint16_t mask);
+  void press_key(uint8_t key);
+  void release_key(uint8_t key);
+  // Instructions per second of emulated time, at least timer_hz
+  void set_clock_hz(uint32_t hz);
+  [[nodiscard]] uint32_t get_clock_hz() const;
+  // Same seed, same CXNN sequence. 0 picks the default seed
+  void seed_rng(uint32_t seed);
+  // Executes exactly num_cycles instructions with the selected backend
+  void run(std::size_t num_cycles);
+  // Executes the instructions up to and including the next 60 Hz tick
+  void run_frame();
+  // Executes as many instructions as fit in emulated_time at the clock rate
+  void run_for(std::chrono::nanoseconds emulated_time);
+  // Read-only view of the whole machine, nothing is copied
+  [[nodiscard]] const chip8_state &get_state() const;
+  // The getters below copy and are kept for compatibility
   [[nodiscard]] std::array<uint8_t, 16> get_V_registers() const;
   [[nodiscard]] std::array<bool, 16> get_Keys_array() const;
   [[nodiscard]] std::array<uint8_t, 4096> get_memory_dump() const;
+  // Unpacked to one byte per pixel
   [[nodiscard]] std::array<uint8_t, display_size> get_display_pixels() const;
   [[nodiscard]] uint16_t get_prog_counter() const;
   [[nodiscard]] uint8_t get_delay_counter() const;
   [[nodiscard]] uint8_t get_sound_counter() const;
   [[nodiscard]] uint16_t get_I_register() const;
-  [[nodiscard]] std::string get_instruction() const;
+  // age 0 is the last executed instruction
+  [[nodiscard]] trace_record get_trace(std::size_t age) const;
+  [[nodiscard]] std::size_t get_trace_size() const;
   [[nodiscard]] std::stack<uint16_t> get_stack() const;
+  [[nodiscard]] fault get_fault() const;
   [[nodiscard]] bool get_display_flag() const;
+  // Rows changed since the previous call, bit n set for row n. Meant to be
+  // called once per rendered frame, after any number of cycles
+  [[nodiscard]] uint32_t present();
+  // Counters since construction or the last reset_profile(). All zero
+  // unless built with profiling
+  [[nodiscard]] const chip8_profile &get_profile() const;
+  void reset_profile();
 
 private:
-  std::array<uint8_t, 4096> memory{0};
-  std::array<uint8_t, 16> V{0};
-  std::stack<uint16_t> hw_stack;
-  std::array<uint8_t, display_size> display{0};
-  std::array<bool, 16> Keys{false};
-  std::unique_ptr<keyboard> numpad{new keyboard()};
-  uint16_t I{0};
-  const uint16_t prog_mem_begin = 512;
-  uint16_t prog_counter{prog_mem_begin};
-  std::string instruction{""};
-  uint8_t delay_timer{0};
-  uint8_t sound_timer{0};
-  bool isKeyBPressed{false};
+  // A handler bound to its operands, the unit of the threaded backend
+  using threaded_handler_t = void (*)(chip8 &, const decoded_opcode &);
+  struct threaded_op {
+    threaded_handler_t handler;
+    decoded_opcode instr;
+  };
+  // Slice of threaded_code holding the block that starts at an address
+  struct block_ref {
+    // Every address can start a block, so threaded_code can hold up to
+    // 4096 * max_block_length ops before it is flushed
+    uint32_t first{0};
+    uint16_t length{0};
+  };
+  static constexpr std::size_t max_block_length = 64;
+  static const std::array<threaded_handler_t, opcode_count> threaded_handlers;
+  template <void (chip8::*op)(const decoded_opcode &)>
+  static void threaded_thunk(chip8 &self, const decoded_opcode &instr) {
+    (self.*op)(instr);
+  }
+
+  [[nodiscard]] uint16_t read_opcode(std::size_t addr) const;
+  [[nodiscard]] const decoded_opcode &fetch_decoded();
+  [[nodiscard]] block_ref compile_block(uint16_t start);
+  void flush_blocks();
+  void run_threaded(std::size_t num_cycles);
+  [[nodiscard]] const uint8_t *rom_bytes() const;
+  void install_rom();
+  void halt(fault error);
+  void begin_cycle();
+  void end_cycle();
+  void profile_cycle(opcode_id id);
+  [[nodiscard]] bool is_key_pressed(uint8_t key);
+  [[nodiscard]] std::pair<bool, uint8_t> first_pressed_key();
+  void invalidate_decoded(uint16_t addr, std::size_t len);
+  void execute(const decoded_opcode &instr);
+  void op_00E0(const decoded_opcode &instr);
+  void op_00EE(const decoded_opcode &instr);
+  void op_1NNN(const decoded_opcode &instr);
+  void op_2NNN(const decoded_opcode &instr);
+  void op_3XNN(const decoded_opcode &instr);
+  void op_4XNN(const decoded_opcode &instr);
+  void op_5XY0(const decoded_opcode &instr);
+  void op_6XNN(const decoded_opcode &instr);
+  void op_7XNN(const decoded_opcode &instr);
+  void op_8XY0(const decoded_opcode &instr);
+  void op_8XY1(const decoded_opcode &instr);
+  void op_8XY2(const decoded_opcode &instr);
+  void op_8XY3(const decoded_opcode &instr);
+  void op_8XY4(const decoded_opcode &instr);
+  void op_8XY5(const decoded_opcode &instr);
+  void op_8XY6(const decoded_opcode &instr);
+  void op_8XY7(const decoded_opcode &instr);
+  void op_8XYE(const decoded_opcode &instr);
+  void op_9XY0(const decoded_opcode &instr);
+  void op_ANNN(const decoded_opcode &instr);
+  void op_BNNN(const decoded_opcode &instr);
+  void op_CXNN(const decoded_opcode &instr);
+  void op_DXYN(const decoded_opcode &instr);
+  void op_EX9E(const decoded_opcode &instr);
+  void op_EXA1(const decoded_opcode &instr);
+  void op_FX07(const decoded_opcode &instr);
+  void op_FX0A(const decoded_opcode &instr);
+  void op_FX15(const decoded_opcode &instr);
+  void op_FX18(const decoded_opcode &instr);
+  void op_FX1E(const decoded_opcode &instr);
+  void op_FX29(const decoded_opcode &instr);
+  void op_FX33(const decoded_opcode &instr);
+  void op_FX55(const decoded_opcode &instr);
+  void op_FX65(const decoded_opcode &instr);
+  void op_unknown(const decoded_opcode &instr);
+
+  chip8_state state;
+  // Optional input source polled by the key opcodes, see set_keys
+  std::unique_ptr<keyboard> numpad;
+  std::array<trace_record, 16> trace{};
+  std::size_t trace_head{0};
+  std::size_t trace_size{0};
+  // Only allocated by profiling builds, the counters are larger than the
+  // emulated machine
+  std::unique_ptr<chip8_profile> profile;
+  // Decoded instruction for every even address, filled on first execution
+  // and dropped again whenever a store touches one of its two bytes
+  std::array<decoded_opcode, 2048> decoded_cache{};
+  std::array<bool, 2048> decoded_valid{false};
+  backend engine{backend::interpreter};
+  uint32_t clock_hz{default_clock_hz};
+  uint32_t rng_seed{default_rng_seed};
+  // The last loaded ROM, for reset(). Either the copy in rom_image or,
+  // after load_mapped, the caller's image
+  std::array<uint8_t, max_rom_size> rom_image{};
+  const uint8_t *rom_view{nullptr};
+  std::size_t rom_size{0};
+  uint64_t run_for_remainder{0};
+  std::vector<threaded_op> threaded_code;
+  std::array<block_ref, 4096> blocks{};
+  // Bytes that belong to at least one compiled block
+  std::array<bool, 4096> is_block_code{false};
+  bool blocks_stale{false};
+  uint32_t dirty_rows{0};
+  static_assert(display_y <= 32, "dirty_rows has one bit per row");
   bool isDisplaySet{false};
 };
 
@@ -0,0 +1,82 @@
+#ifndef CHIP8_POOL_H_
+#define CHIP8_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "chip8.hpp"
+
+// What a pool run did to one instance
+struct pool_result {
+  std::size_t frames{0};
+  fault error{fault::none};
+};
+
+// Many independent machines stepped in parallel, for ROM corpora and fuzz
+// inputs. The instances live in one array of cache line aligned slots.
+// Every time slice runs one frame of each instance. Each worker starts on
+// its own share of the instances and steals from the others once it runs
+// out
+//
+// A slot is a whole chip8, about 62 KB of which chip8_state is 4.3 KB. The
+// rest is the decoded instruction cache, the threaded block tables and the
+// ROM copy for reset(). They stay per instance on purpose: instances may
+// rewrite their own code, so nothing decoded can be shared, and a running
+// instance only touches the entries of its hot loop. Budget the pool's
+// memory by sizeof(chip8), not by the machine state
+class chip8_pool {
+public:
+  // workers 0 means one per hardware thread
+  explicit chip8_pool(std::size_t instances,
+                      backend selected = backend::interpreter,
+                      std::size_t workers = 0);
+  chip8_pool(const chip8_pool &) = delete;
+  chip8_pool &operator=(const chip8_pool &) = delete;
+  ~chip8_pool();
+
+  [[nodiscard]] std::size_t size() const;
+  [[nodiscard]] std::size_t worker_count() const;
+  // For loading ROMs, seeds and keys in between runs. Loading a ROM
+  // clears a fault, so the instance runs again
+  [[nodiscard]] chip8 &instance(std::size_t index);
+  [[nodiscard]] const pool_result &result(std::size_t index) const;
+  // Runs up to frames more frames of every instance, faulted instances
+  // are skipped
+  void run_frames(std::size_t frames);
+
+private:
+  struct alignas(64) slot {
+    explicit slot(backend selected) : machine{selected} {}
+    chip8 machine;
+    pool_result result;
+  };
+  // A worker's share of a slice, claimed one instance at a time by the
+  // owner and by thieves alike
+  struct alignas(64) work_range {
+    std::atomic<std::size_t> next{0};
+    std::size_t end{0};
+  };
+  void work(std::size_t worker);
+  // Wakes every worker to exit and joins them
+  void stop_workers();
+  void run_slice(std::size_t worker);
+  void step(std::size_t index);
+
+  std::vector<slot> slots;
+  std::unique_ptr<work_range[]> ranges;
+  std::vector<std::thread> threads;
+  std::mutex lock;
+  std::condition_variable wake;
+  std::condition_variable done;
+  uint64_t generation{0};
+  std::size_t busy{0};
+  bool stopping{false};
+};
+
+#endif // CHIP8_POOL_H_
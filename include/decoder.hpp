@@ -0,0 +1,245 @@
+#ifndef DECODER_H_
+#define DECODER_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Mask function to get the first Nibble 0xN000
+// example: input is 0x6133, output will be 0x6000
+constexpr uint16_t first_nibble(const uint16_t opcode) noexcept {
+  return (opcode & 0xF000U);
+}
+
+// Mask function to get the second Nibble 0x0N00
+// example: input is 0x6133, output will be 0x0100
+constexpr uint16_t second_nibble(const uint16_t opcode) noexcept {
+  return (opcode & 0x0F00U);
+}
+
+// Mask function to get the third Nibble 0x00N0
+// example: input is 0x6133, output will be 0x0030
+constexpr uint8_t third_nibble(const uint16_t opcode) noexcept {
+  return (opcode & 0x00F0U);
+}
+
+// Mask function to get the last Nibble 0x000N
+// example: input is 0x6133, output will be 0x0003
+constexpr uint8_t last_nibble(const uint16_t opcode) noexcept {
+  return (opcode & 0x000FU);
+}
+
+// Mask function to get the last two nibbles 0x00NN
+// example: input is 0x6133, output will be 0x0033
+constexpr uint8_t last_two_nibbles(const uint16_t opcode) noexcept {
+  return (opcode & 0x00FFU);
+}
+
+// Mask function to get the last three nibbles 0x0NNN
+// example: input is 0x6133, output will be 0x0133
+constexpr uint16_t last_three_nibbles(const uint16_t opcode) noexcept {
+  return (opcode & 0x0FFFU);
+}
+
+// One entry per instruction the interpreter knows how to execute.
+// The order is the dispatch order of the handler table in chip8.cpp
+enum class opcode_id : uint8_t {
+  OP_00E0,
+  OP_00EE,
+  OP_1NNN,
+  OP_2NNN,
+  OP_3XNN,
+  OP_4XNN,
+  OP_5XY0,
+  OP_6XNN,
+  OP_7XNN,
+  OP_8XY0,
+  OP_8XY1,
+  OP_8XY2,
+  OP_8XY3,
+  OP_8XY4,
+  OP_8XY5,
+  OP_8XY6,
+  OP_8XY7,
+  OP_8XYE,
+  OP_9XY0,
+  OP_ANNN,
+  OP_BNNN,
+  OP_CXNN,
+  OP_DXYN,
+  OP_EX9E,
+  OP_EXA1,
+  OP_FX07,
+  OP_FX0A,
+  OP_FX15,
+  OP_FX18,
+  OP_FX1E,
+  OP_FX29,
+  OP_FX33,
+  OP_FX55,
+  OP_FX65,
+  UNKNOWN
+};
+
+static constexpr auto opcode_count =
+    static_cast<std::size_t>(opcode_id::UNKNOWN) + 1;
+
+// Indexed by opcode_id, for reports
+static constexpr std::array<const char *, opcode_count> opcode_names = {
+    "00E0", "00EE", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0",
+    "6XNN", "7XNN", "8XY0", "8XY1", "8XY2", "8XY3", "8XY4",
+    "8XY5", "8XY6", "8XY7", "8XYE", "9XY0", "ANNN", "BNNN",
+    "CXNN", "DXYN", "EX9E", "EXA1", "FX07", "FX0A", "FX15",
+    "FX18", "FX1E", "FX29", "FX33", "FX55", "FX65", "unknown"};
+
+// An opcode with all of its operands already extracted, so the
+// execution stage never has to mask and shift the raw 16 bits again
+struct decoded_opcode {
+  opcode_id id{opcode_id::UNKNOWN};
+  uint8_t X{0};
+  uint8_t Y{0};
+  uint8_t N{0};
+  uint8_t NN{0};
+  uint16_t NNN{0};
+};
+
+constexpr decoded_opcode decode(const uint16_t opcode) noexcept {
+  decoded_opcode instr{};
+  instr.X = static_cast<uint8_t>(second_nibble(opcode) >> 8);
+  instr.Y = static_cast<uint8_t>(third_nibble(opcode) >> 4);
+  instr.N = last_nibble(opcode);
+  instr.NN = last_two_nibbles(opcode);
+  instr.NNN = last_three_nibbles(opcode);
+
+  switch (first_nibble(opcode)) {
+  case (0x0000):
+    if (instr.NN == 0xE0) {
+      instr.id = opcode_id::OP_00E0;
+    } else if (instr.NN == 0xEE) {
+      instr.id = opcode_id::OP_00EE;
+    }
+    break;
+  case (0x1000):
+    instr.id = opcode_id::OP_1NNN;
+    break;
+  case (0x2000):
+    instr.id = opcode_id::OP_2NNN;
+    break;
+  case (0x3000):
+    instr.id = opcode_id::OP_3XNN;
+    break;
+  case (0x4000):
+    instr.id = opcode_id::OP_4XNN;
+    break;
+  // The last nibble of 5XY0 and 9XY0 is not checked, as before
+  case (0x5000):
+    instr.id = opcode_id::OP_5XY0;
+    break;
+  case (0x6000):
+    instr.id = opcode_id::OP_6XNN;
+    break;
+  case (0x7000):
+    instr.id = opcode_id::OP_7XNN;
+    break;
+  case (0x8000):
+    switch (instr.N) {
+    case (0x0):
+      instr.id = opcode_id::OP_8XY0;
+      break;
+    case (0x1):
+      instr.id = opcode_id::OP_8XY1;
+      break;
+    case (0x2):
+      instr.id = opcode_id::OP_8XY2;
+      break;
+    case (0x3):
+      instr.id = opcode_id::OP_8XY3;
+      break;
+    case (0x4):
+      instr.id = opcode_id::OP_8XY4;
+      break;
+    case (0x5):
+      instr.id = opcode_id::OP_8XY5;
+      break;
+    case (0x6):
+      instr.id = opcode_id::OP_8XY6;
+      break;
+    case (0x7):
+      instr.id = opcode_id::OP_8XY7;
+      break;
+    case (0xE):
+      instr.id = opcode_id::OP_8XYE;
+      break;
+    default:
+      break;
+    }
+    break;
+  case (0x9000):
+    instr.id = opcode_id::OP_9XY0;
+    break;
+  case (0xA000):
+    instr.id = opcode_id::OP_ANNN;
+    break;
+  case (0xB000):
+    instr.id = opcode_id::OP_BNNN;
+    break;
+  case (0xC000):
+    instr.id = opcode_id::OP_CXNN;
+    break;
+  case (0xD000):
+    instr.id = opcode_id::OP_DXYN;
+    break;
+  case (0xE000):
+    if (instr.NN == 0x9E) {
+      instr.id = opcode_id::OP_EX9E;
+    } else if (instr.NN == 0xA1) {
+      instr.id = opcode_id::OP_EXA1;
+    }
+    break;
+  case (0xF000):
+    switch (instr.NN) {
+    case (0x07):
+      instr.id = opcode_id::OP_FX07;
+      break;
+    case (0x0A):
+      instr.id = opcode_id::OP_FX0A;
+      break;
+    case (0x15):
+      instr.id = opcode_id::OP_FX15;
+      break;
+    case (0x18):
+      instr.id = opcode_id::OP_FX18;
+      break;
+    case (0x1E):
+      instr.id = opcode_id::OP_FX1E;
+      break;
+    case (0x29):
+      instr.id = opcode_id::OP_FX29;
+      break;
+    case (0x33):
+      instr.id = opcode_id::OP_FX33;
+      break;
+    case (0x55):
+      instr.id = opcode_id::OP_FX55;
+      break;
+    case (0x65):
+      instr.id = opcode_id::OP_FX65;
+      break;
+    default:
+      break;
+    }
+    break;
+  default:
+    break;
+  }
+  return instr;
+}
+
+// All 65536 opcodes decoded at compile time, see decoder.cpp
+extern const std::array<decoded_opcode, 0x10000> decode_table;
+
+inline const decoded_opcode &lookup(const uint16_t opcode) noexcept {
+  return decode_table[opcode];
+}
+
+#endif // DECODER_H_
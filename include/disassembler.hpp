@@ -0,0 +1,50 @@
+#ifndef DISASSEMBLER_H_
+#define DISASSEMBLER_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "chip8.hpp"
+
+// Longest line produced, including the address prefix and the '\0'
+static constexpr std::size_t disassembly_max_length = 40;
+
+// Writes the text for a single opcode into buffer and returns the number
+// of characters written. The text is truncated to fit and always '\0'
+// terminated. Only the opcode is known here, so operands that depend on
+// the machine state are printed symbolically (DT, ST, I...)
+std::size_t disassemble(uint16_t opcode, char *buffer, std::size_t size);
+
+// Same as above, prefixed with the address the opcode was read from
+std::size_t disassemble(uint16_t prog_counter, uint16_t opcode, char *buffer,
+                        std::size_t size);
+
+// Allocating convenience wrapper, meant for tests and one-off prints
+std::string disassemble(uint16_t opcode);
+
+// Disassembly of the last instruction the emulator executed, empty
+// without tracing
+std::string last_instruction(const chip8 &emulator);
+
+// Disassembles every opcode in [first, last) of a memory dump, calling
+// sink(prog_counter, text) once per opcode. No allocation takes place, the
+// text only lives until sink returns
+template <typename Sink>
+void disassemble_range(const std::array<uint8_t, 4096> &memory,
+                       const uint16_t first, const uint16_t last,
+                       Sink &&sink) {
+  std::array<char, disassembly_max_length> line{};
+  for (std::size_t addr = first; addr + 1 < last && addr + 1 < memory.size();
+       addr += 2) {
+    // The memory is read in big endian, i.e., MSB first
+    const auto opcode =
+        static_cast<uint16_t>((memory[addr] << 8) | (memory[addr + 1]));
+    const auto pc = static_cast<uint16_t>(addr);
+    disassemble(pc, opcode, line.data(), line.size());
+    sink(pc, static_cast<const char *>(line.data()));
+  }
+}
+
+#endif // DISASSEMBLER_H_
@@ -0,0 +1,20 @@
+#ifndef HASH_H_
+#define HASH_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// 64-bit FNV-1a. Pass the previous result as seed to hash data that is
+// not contiguous in memory
+static constexpr uint64_t fnv1a_offset = 0xcbf29ce484222325U;
+static constexpr uint64_t fnv1a_prime = 0x100000001b3U;
+
+constexpr uint64_t fnv1a(const uint8_t *data, const std::size_t size,
+                         uint64_t seed = fnv1a_offset) noexcept {
+  for (std::size_t i = 0; i < size; ++i) {
+    seed = (seed ^ data[i]) * fnv1a_prime;
+  }
+  return seed;
+}
+
+#endif // HASH_H_
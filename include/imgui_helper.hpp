@@ -2,54 +2,112 @@
 #define IMGUI_HELPER_H_
 
 // System headers
+#include <algorithm>
 #include <array>
 #include <cstdint>
-#include <stack>
+#include <limits>
+
+// Own headers
+#include "chip8.hpp"
+#include "disassembler.hpp"
+#include "profile.hpp"
 
 // Third-party headers
-#include <boost/circular_buffer.hpp>
 #include <imgui-SFML.h>
 #include <imgui.h>
 
 namespace IMGUI {
-using circ_buf = boost::circular_buffer<std::string>;
-
 
-struct chip8_registers {
-  std::array<uint8_t, 16> V{0};
-  std::stack<uint16_t> hw_stack;
-  uint16_t prog_counter{};
-  uint16_t I{0};
-};
-
-inline void draw_registers_window(chip8_registers &&regs) {
+inline void draw_registers_window(const chip8_state &state) {
 
   ImGui::Begin("Internal Register");
   ImGui::SetWindowPos(ImVec2(5, 5), ImGuiCond_Once);
   ImGui::BeginChild("Scrolling", ImVec2(300, 600));
-  ImGui::TextColored(ImVec4(1, 0, 0, 1), "PC     : %d", regs.prog_counter);
+  ImGui::TextColored(ImVec4(1, 0, 0, 1), "PC     : %d", state.prog_counter);
   ImGui::Separator();
-  ImGui::TextColored(ImVec4(1, 0, 0, 1), "I      : %#x", regs.I);
+  ImGui::TextColored(ImVec4(1, 0, 0, 1), "I      : %#x", state.I);
   ImGui::Separator();
   ImGui::TextColored(ImVec4(1, 0, 0, 1), "V register");
   auto index = 0;
-  for (auto reg : regs.V) {
+  for (auto reg : state.V) {
     ImGui::Text("V[0x%x] : %#x", index, reg);
     ++index;
   }
   ImGui::Separator();
-  auto stack_index = static_cast<uint>(regs.hw_stack.size());
   ImGui::TextColored(ImVec4(1, 0, 0, 1), "Stack");
-  while (!regs.hw_stack.empty()) {
-    ImGui::Text("V[0x%x] : %#x", stack_index, regs.hw_stack.top());
-    regs.hw_stack.pop();
-    --stack_index;
+  for (auto level = state.stack_pointer; level > 0; --level) {
+    ImGui::Text("V[0x%x] : %#x", level, state.hw_stack[level - 1U]);
+  }
+  ImGui::EndChild();
+  ImGui::End();
+}
+
+// Opcode mix, hottest addresses and instructions per frame of a profiling
+// build, see chip8_profile
+inline void draw_profile_window(const chip8_profile &profile) {
+  ImGui::Begin("Profile");
+  ImGui::SetWindowPos(ImVec2(1200, 450), ImGuiCond_Once);
+  ImGui::BeginChild("Scrolling", ImVec2(300, 500));
+  uint64_t total = 0;
+  for (const auto count : profile.opcodes) {
+    total += count;
+  }
+  ImGui::Text("Instructions  : %llu", static_cast<unsigned long long>(total));
+  ImGui::Text("Sprite pixels : %llu",
+              static_cast<unsigned long long>(profile.sprite_pixels));
+  ImGui::Text("Key polls     : %llu",
+              static_cast<unsigned long long>(profile.key_polls));
+  ImGui::Separator();
+  ImGui::TextColored(ImVec4(1, 0, 0, 1), "Instructions per frame");
+  std::array<float, frame_buckets> frames{};
+  for (std::size_t bucket = 0; bucket < frame_buckets; ++bucket) {
+    frames[bucket] = static_cast<float>(profile.frame_instructions[bucket]);
+  }
+  ImGui::PlotHistogram("##frames", frames.data(),
+                       static_cast<int>(frames.size()), 0, "log2 buckets",
+                       0.0F, std::numeric_limits<float>::max(),
+                       ImVec2(280, 60));
+  ImGui::Separator();
+  ImGui::TextColored(ImVec4(1, 0, 0, 1), "Opcodes");
+  for (std::size_t id = 0; id < opcode_count; ++id) {
+    const auto count = profile.opcodes[id];
+    if (count != 0) {
+      ImGui::Text("%-7s %6.2f%% %llu", opcode_names[id],
+                  100.0 * static_cast<double>(count) /
+                      static_cast<double>(total),
+                  static_cast<unsigned long long>(count));
+    }
+  }
+  ImGui::Separator();
+  ImGui::TextColored(ImVec4(1, 0, 0, 1), "Hottest addresses");
+  // Insertion into a short sorted list, most executed first
+  std::array<std::size_t, 8> hottest{};
+  std::size_t found = 0;
+  for (std::size_t addr = 0; addr < profile.prog_counters.size(); ++addr) {
+    const auto count = profile.prog_counters[addr];
+    if (count == 0 ||
+        (found == hottest.size() &&
+         count <= profile.prog_counters[hottest.back()])) {
+      continue;
+    }
+    auto slot = std::min(found, hottest.size() - 1);
+    found = std::min(found + 1, hottest.size());
+    for (; slot > 0 && profile.prog_counters[hottest[slot - 1]] < count;
+         --slot) {
+      hottest[slot] = hottest[slot - 1];
+    }
+    hottest[slot] = addr;
+  }
+  for (std::size_t rank = 0; rank < found; ++rank) {
+    ImGui::Text("%#05zx : %llu", hottest[rank],
+                static_cast<unsigned long long>(
+                    profile.prog_counters[hottest[rank]]));
   }
   ImGui::EndChild();
   ImGui::End();
 }
 
-inline bool draw_debugger_options(bool &fall_through) {
+inline bool draw_debugger_options(bool &fall_through, bool &step_back) {
   bool step_next = false;
   ImGui::Begin("Debugger");
   ImGui::SetWindowPos(ImVec2(1200, 300), ImGuiCond_Once);
@@ -57,6 +115,7 @@ inline bool draw_debugger_options(bool &fall_through) {
   if (ImGui::Button("Step Next")) {
     step_next = true;
   }
+  step_back = ImGui::Button("Step Back");
   if (ImGui::Button("Continue")) {
     fall_through = true;
   }
@@ -67,24 +126,31 @@ inline bool draw_debugger_options(bool &fall_through) {
   return (step_next || fall_through);
 }
 
-inline void draw_instruction_window(const circ_buf &instr_cb) {
+// The trace only holds raw opcodes, they are disassembled here
+// and only for the frames where the window is drawn
+inline void draw_instruction_window(const chip8 &emulator) {
   ImGui::Begin("Instruction window");
   ImGui::SetWindowFontScale(1.15F);
   ImGui::SetWindowPos(ImVec2(800, 800), ImGuiCond_Once);
   ImGui::BeginChild("Scrolling", ImVec2(300, 300));
-  for (const auto &instr : instr_cb) {
-    ImGui::Text("%s", instr.c_str());
+  std::array<char, disassembly_max_length> line{};
+  for (std::size_t age = 0; age < emulator.get_trace_size(); ++age) {
+    const auto record = emulator.get_trace(age);
+    disassemble(record.prog_counter, record.opcode, line.data(), line.size());
+    ImGui::TextUnformatted(line.data());
   }
   ImGui::EndChild();
   ImGui::End();
 }
 
-inline void draw_slider_window(int &slider_input) {
+// slider_input is the instruction clock in Hz
+inline void draw_slider_window(int &slider_input, bool &turbo) {
   ImGui::Begin("Adjust Speed");
   ImGui::SetWindowPos(ImVec2(800, 5), ImGuiCond_Once);
   ImGui::BeginChild("", ImVec2(300, 20));
-  ImGui::SliderInt("", &slider_input, 1, 20);
+  ImGui::SliderInt("Hz", &slider_input, static_cast<int>(timer_hz), 1200);
   ImGui::EndChild();
+  ImGui::Checkbox("Turbo (Tab)", &turbo);
   ImGui::End();
 }
 } // IMGUI 
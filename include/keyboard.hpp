@@ -1,19 +1,17 @@
 #ifndef KEYBOARD_H_
 #define KEYBOARD_H_
 
-#include <array>
 #include <cstdint>
+#include <utility>
 
+// Input source for the keypad opcodes. The core only knows this interface,
+// the frontends provide the implementation (see sfml_keyboard.hpp)
 class keyboard {
 public:
-  virtual bool isKeyVxPressed(const uint8_t &num);
-  virtual std::pair<bool,uint8_t> whichKeyIndexIfPressed();
-  virtual void clearKeyInput();
+  virtual bool isKeyVxPressed(const uint8_t &num) = 0;
+  virtual std::pair<bool, uint8_t> whichKeyIndexIfPressed() = 0;
+  virtual void clearKeyInput() = 0;
   virtual ~keyboard() = default;
-
-private:
-  std::array<bool, 16> Keys{false};
-  void storeKeyPress();
 };
 
-#endif // KEYBOARD_H_
\ No newline at end of file
+#endif // KEYBOARD_H_
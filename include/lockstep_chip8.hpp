@@ -0,0 +1,553 @@
+#ifndef LOCKSTEP_CHIP8_H_
+#define LOCKSTEP_CHIP8_H_
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+#include "chip8.hpp"
+#include "decoder.hpp"
+
+// Lanes machines running the same ROM together, for batches that only
+// differ in seeds, keys or starting state. The registers are stored
+// structure of arrays (V[x] holds VX of every lane), so an instruction
+// executed by all lanes at once is a loop over contiguous arrays that the
+// compiler turns into vector code. Lanes whose program counter or opcode
+// differ from the others are split into groups, each executed on its own
+// with the same handlers, until they meet at the same instruction again
+template <std::size_t Lanes> class lockstep_chip8 {
+  static_assert(Lanes > 0 && Lanes <= 32, "lane masks are 32 bits wide");
+  using lane_mask = uint32_t;
+
+public:
+  lockstep_chip8() { load_memory({}); }
+
+  // Same ROM in every lane, everything else back to power on
+  void load_memory(const std::vector<uint8_t> &rom_opcodes) {
+    chip8 loader;
+    loader.load_memory(rom_opcodes);
+    for (std::size_t lane = 0; lane < Lanes; ++lane) {
+      assign(lane, loader.get_state());
+    }
+    same_memory = true;
+  }
+
+  void load_state(const std::size_t lane, const chip8_state &snapshot) {
+    check_lane(lane);
+    assign(lane, snapshot);
+    same_memory = std::all_of(memory.begin(), memory.end(),
+                              [&](const auto &other) {
+                                return other == snapshot.memory;
+                              });
+  }
+
+  // Gathered into a copy, a lane has no chip8_state of its own
+  [[nodiscard]] chip8_state get_state(const std::size_t lane) const {
+    check_lane(lane);
+    chip8_state state;
+    state.memory = memory[lane];
+    for (std::size_t x = 0; x < V.size(); ++x) {
+      state.V[x] = V[x][lane];
+    }
+    state.hw_stack = hw_stack[lane];
+    state.stack_pointer = stack_pointer[lane];
+    state.display = display[lane];
+    state.I = I[lane];
+    state.prog_counter = prog_counter[lane];
+    state.delay_timer = delay_timer[lane];
+    state.sound_timer = sound_timer[lane];
+    state.timer_phase = timer_phase[lane];
+    state.keys = keys[lane];
+    state.rng = rng[lane];
+    state.error = error[lane];
+    return state;
+  }
+
+  void set_keys(const std::size_t lane, const uint16_t mask) {
+    check_lane(lane);
+    keys[lane] = mask;
+  }
+
+  // Same seed, same CXNN sequence. 0 picks the default seed
+  void seed_rng(const std::size_t lane, const uint32_t seed) {
+    check_lane(lane);
+    rng[lane] = (seed != 0) ? seed : default_rng_seed;
+  }
+
+  [[nodiscard]] fault get_fault(const std::size_t lane) const {
+    check_lane(lane);
+    return error[lane];
+  }
+
+  // Shared by every lane, at least timer_hz
+  void set_clock_hz(const uint32_t hz) {
+    if (hz < timer_hz) {
+      throw std::invalid_argument(
+          "The clock can not be slower than the timers");
+    }
+    clock_hz = hz;
+    for (auto &phase : timer_phase) {
+      phase %= clock_hz;
+    }
+  }
+  [[nodiscard]] uint32_t get_clock_hz() const { return clock_hz; }
+
+  // Every lane that has not faulted executes num_cycles instructions
+  void run(const std::size_t num_cycles) {
+    for (std::size_t cycle = 0; cycle < num_cycles; ++cycle) {
+      step();
+    }
+  }
+
+  // Up to and including the next 60 Hz tick of the first running lane.
+  // Lanes only fall out of phase when they are loaded that way
+  void run_frame() {
+    for (std::size_t lane = 0; lane < Lanes; ++lane) {
+      if (error[lane] == fault::none) {
+        run((clock_hz - timer_phase[lane] + timer_hz - 1) / timer_hz);
+        return;
+      }
+    }
+  }
+
+  // Instructions dispatched so far, one per group and cycle. Equal to the
+  // cycles run while the lanes never split up
+  [[nodiscard]] std::size_t get_dispatch_count() const { return dispatches; }
+
+private:
+  template <typename T> using lanes_of = std::array<T, Lanes>;
+
+  static void check_lane(const std::size_t lane) {
+    if (lane >= Lanes) {
+      throw std::out_of_range("No such lane");
+    }
+  }
+
+  // value where the lane is active, old elsewhere. Branch free so the
+  // lane loops vectorise
+  template <typename T, typename M>
+  static T select(const M on, const T value, const T old) {
+    return static_cast<T>((value & on) | (old & static_cast<M>(~on)));
+  }
+
+  void assign(const std::size_t lane, const chip8_state &snapshot) {
+    memory[lane] = snapshot.memory;
+    for (std::size_t x = 0; x < V.size(); ++x) {
+      V[x][lane] = snapshot.V[x];
+    }
+    hw_stack[lane] = snapshot.hw_stack;
+    stack_pointer[lane] = snapshot.stack_pointer;
+    display[lane] = snapshot.display;
+    I[lane] = snapshot.I;
+    prog_counter[lane] = snapshot.prog_counter;
+    delay_timer[lane] = snapshot.delay_timer;
+    sound_timer[lane] = snapshot.sound_timer;
+    timer_phase[lane] = snapshot.timer_phase;
+    keys[lane] = snapshot.keys;
+    rng[lane] = snapshot.rng;
+    set_fault(lane, snapshot.error);
+  }
+
+  void set_fault(const std::size_t lane, const fault reason) {
+    error[lane] = reason;
+    const bool runs = reason == fault::none;
+    running = (running & ~(1U << lane)) | ((runs ? 1U : 0U) << lane);
+    running16[lane] = runs ? 0xFFFFU : 0U;
+  }
+
+  [[nodiscard]] uint16_t read_opcode(const std::size_t lane,
+                                     const std::size_t addr) const {
+    return static_cast<uint16_t>((memory[lane][addr & 0xFFFU] << 8) |
+                                 memory[lane][(addr + 1) & 0xFFFU]);
+  }
+
+  void step() {
+    lane_mask pending = running;
+    if (pending == 0) {
+      return;
+    }
+    // Common case: identical memories and every lane at the same address,
+    // so there is no need to look at each lane's opcode
+    if (same_memory) {
+      std::size_t leader = 0;
+      while (((pending >> leader) & 1U) == 0) {
+        ++leader;
+      }
+      const auto at = prog_counter[leader];
+      uint16_t apart = 0;
+      for (std::size_t lane = 0; lane < Lanes; ++lane) {
+        apart |= static_cast<uint16_t>((prog_counter[lane] ^ at) &
+                                       running16[lane]);
+      }
+      if (apart == 0) {
+        execute(lookup(read_opcode(leader, at)), pending);
+        ++dispatches;
+        return;
+      }
+    }
+    while (pending != 0) {
+      std::size_t leader = 0;
+      while (((pending >> leader) & 1U) == 0) {
+        ++leader;
+      }
+      const auto at = prog_counter[leader];
+      const auto opcode = read_opcode(leader, at);
+      lane_mask group = 0;
+      for (std::size_t lane = 0; lane < Lanes; ++lane) {
+        const bool same = ((pending >> lane) & 1U) != 0 &&
+                          prog_counter[lane] == at &&
+                          read_opcode(lane, at) == opcode;
+        group |= (same ? 1U : 0U) << lane;
+      }
+      execute(lookup(opcode), group);
+      pending &= ~group;
+      ++dispatches;
+    }
+  }
+
+  void execute(const decoded_opcode &instr, const lane_mask group) {
+    if (group != active) {
+      active = group;
+      for (std::size_t lane = 0; lane < Lanes; ++lane) {
+        const bool on = ((group >> lane) & 1U) != 0;
+        on8[lane] = on ? 0xFFU : 0U;
+        on16[lane] = on ? 0xFFFFU : 0U;
+      }
+    }
+    for (std::size_t lane = 0; lane < Lanes; ++lane) {
+      prog_counter[lane] =
+          select(on16[lane], static_cast<uint16_t>(prog_counter[lane] + 2),
+                 prog_counter[lane]);
+    }
+    dispatch(instr);
+    end_cycle();
+  }
+
+  // Same timer rule as chip8::end_cycle, for the active lanes only
+  void end_cycle() {
+    for (std::size_t lane = 0; lane < Lanes; ++lane) {
+      const uint32_t phase = timer_phase[lane] + (timer_hz & on16[lane]);
+      const uint32_t tick =
+          (on16[lane] != 0 && phase >= clock_hz) ? 1U : 0U;
+      timer_phase[lane] = phase - clock_hz * tick;
+      delay_timer[lane] = static_cast<uint8_t>(
+          delay_timer[lane] - ((delay_timer[lane] != 0) ? tick : 0U));
+      sound_timer[lane] = static_cast<uint8_t>(
+          sound_timer[lane] - ((sound_timer[lane] != 0) ? tick : 0U));
+    }
+  }
+
+  // For the handlers that index memory, display or stack per lane
+  template <typename F> void each_active(F &&body) {
+    for (std::size_t lane = 0; lane < Lanes; ++lane) {
+      if (((active >> lane) & 1U) != 0) {
+        body(lane);
+      }
+    }
+  }
+
+  void halt(const std::size_t lane, const fault reason) {
+    set_fault(lane, reason);
+    prog_counter[lane] = static_cast<uint16_t>(prog_counter[lane] - 2);
+  }
+
+  // pc + 2 where cond holds in an active lane
+  template <typename C> void skip_if(C &&cond, const bool wrap) {
+    for (std::size_t lane = 0; lane < Lanes; ++lane) {
+      const uint16_t on = cond(lane) ? on16[lane] : uint16_t{0};
+      auto next = static_cast<uint16_t>(prog_counter[lane] + 2);
+      if (wrap) {
+        next &= 0x0FFFU;
+      }
+      prog_counter[lane] = select(on, next, prog_counter[lane]);
+    }
+  }
+
+  // VX = op(lane) in the active lanes
+  template <typename F> void set_vx(const uint8_t x, F &&op) {
+    for (std::size_t lane = 0; lane < Lanes; ++lane) {
+      V[x][lane] = select(on8[lane], static_cast<uint8_t>(op(lane)),
+                          V[x][lane]);
+    }
+  }
+
+  // The handlers mirror chip8.cpp statement by statement, so overlapping
+  // X, Y and F registers come out the same
+  void dispatch(const decoded_opcode &instr) {
+    const auto X = instr.X;
+    const auto Y = instr.Y;
+    auto &VX = V[X];
+    auto &VY = V[Y];
+    switch (instr.id) {
+    case opcode_id::OP_00E0:
+      each_active([&](std::size_t lane) { display[lane].fill(0); });
+      break;
+    case opcode_id::OP_00EE:
+      each_active([&](std::size_t lane) {
+        if (stack_pointer[lane] == 0) {
+          halt(lane, fault::stack_underflow);
+          return;
+        }
+        --stack_pointer[lane];
+        prog_counter[lane] = hw_stack[lane][stack_pointer[lane]];
+      });
+      break;
+    case opcode_id::OP_1NNN:
+      for (std::size_t lane = 0; lane < Lanes; ++lane) {
+        prog_counter[lane] =
+            select(on16[lane], instr.NNN, prog_counter[lane]);
+      }
+      break;
+    case opcode_id::OP_2NNN:
+      each_active([&](std::size_t lane) {
+        if (stack_pointer[lane] == stack_depth) {
+          halt(lane, fault::stack_overflow);
+          return;
+        }
+        hw_stack[lane][stack_pointer[lane]] = prog_counter[lane];
+        ++stack_pointer[lane];
+        prog_counter[lane] = instr.NNN;
+      });
+      break;
+    case opcode_id::OP_3XNN:
+      skip_if([&](std::size_t lane) { return VX[lane] == instr.NN; }, true);
+      break;
+    case opcode_id::OP_4XNN:
+      skip_if([&](std::size_t lane) { return VX[lane] != instr.NN; }, true);
+      break;
+    case opcode_id::OP_5XY0:
+      skip_if([&](std::size_t lane) { return VX[lane] == VY[lane]; }, true);
+      break;
+    case opcode_id::OP_6XNN:
+      set_vx(X, [&](std::size_t /*lane*/) { return instr.NN; });
+      break;
+    case opcode_id::OP_7XNN:
+      set_vx(X, [&](std::size_t lane) { return VX[lane] + instr.NN; });
+      break;
+    case opcode_id::OP_8XY0:
+      set_vx(X, [&](std::size_t lane) { return VY[lane]; });
+      break;
+    case opcode_id::OP_8XY1:
+      set_vx(X, [&](std::size_t lane) { return VX[lane] | VY[lane]; });
+      break;
+    case opcode_id::OP_8XY2:
+      set_vx(X, [&](std::size_t lane) { return VX[lane] & VY[lane]; });
+      break;
+    case opcode_id::OP_8XY3:
+      set_vx(X, [&](std::size_t lane) { return VX[lane] ^ VY[lane]; });
+      break;
+    case opcode_id::OP_8XY4: {
+      lanes_of<uint16_t> sum{};
+      for (std::size_t lane = 0; lane < Lanes; ++lane) {
+        sum[lane] = static_cast<uint16_t>(VY[lane] + VX[lane]);
+      }
+      set_vx(0xF, [&](std::size_t lane) { return (sum[lane] & 0x100) >> 8; });
+      set_vx(X, [&](std::size_t lane) { return sum[lane]; });
+      break;
+    }
+    case opcode_id::OP_8XY5:
+      set_vx(0xF, [&](std::size_t lane) { return VX[lane] > VY[lane]; });
+      set_vx(X, [&](std::size_t lane) { return VX[lane] - VY[lane]; });
+      break;
+    case opcode_id::OP_8XY6:
+      set_vx(0xF, [&](std::size_t lane) { return VY[lane] & 0x01; });
+      set_vx(Y, [&](std::size_t lane) { return VY[lane] >> 1; });
+      set_vx(X, [&](std::size_t lane) { return VY[lane]; });
+      break;
+    case opcode_id::OP_8XY7:
+      set_vx(0xF, [&](std::size_t lane) { return VY[lane] > VX[lane]; });
+      set_vx(X, [&](std::size_t lane) { return VY[lane] - VX[lane]; });
+      break;
+    case opcode_id::OP_8XYE:
+      set_vx(0xF, [&](std::size_t lane) { return (VY[lane] & 0x80) >> 7; });
+      set_vx(Y, [&](std::size_t lane) { return VY[lane] << 1; });
+      set_vx(X, [&](std::size_t lane) { return VY[lane]; });
+      break;
+    case opcode_id::OP_9XY0:
+      skip_if([&](std::size_t lane) { return VX[lane] != VY[lane]; }, true);
+      break;
+    case opcode_id::OP_ANNN:
+      for (std::size_t lane = 0; lane < Lanes; ++lane) {
+        I[lane] = select(on16[lane], instr.NNN, I[lane]);
+      }
+      break;
+    case opcode_id::OP_BNNN:
+      for (std::size_t lane = 0; lane < Lanes; ++lane) {
+        const auto target = static_cast<uint16_t>(
+            static_cast<uint16_t>(instr.NNN + V[0][lane]) & 0x0FFFU);
+        prog_counter[lane] = select(on16[lane], target, prog_counter[lane]);
+      }
+      break;
+    case opcode_id::OP_CXNN:
+      for (std::size_t lane = 0; lane < Lanes; ++lane) {
+        // xorshift32, as in chip8::op_CXNN
+        auto x = rng[lane];
+        x ^= x << 13U;
+        x ^= x >> 17U;
+        x ^= x << 5U;
+        rng[lane] = (on8[lane] != 0) ? x : rng[lane];
+      }
+      set_vx(X, [&](std::size_t lane) { return (rng[lane] >> 24U) & instr.NN; });
+      break;
+    case opcode_id::OP_DXYN:
+      each_active([&](std::size_t lane) { draw(lane, instr); });
+      break;
+    case opcode_id::OP_EX9E:
+      skip_if([&](std::size_t lane) { return pressed(lane, VX[lane]); },
+              false);
+      break;
+    case opcode_id::OP_EXA1:
+      skip_if([&](std::size_t lane) { return !pressed(lane, VX[lane]); },
+              false);
+      break;
+    case opcode_id::OP_FX07:
+      set_vx(X, [&](std::size_t lane) { return delay_timer[lane]; });
+      break;
+    case opcode_id::OP_FX0A:
+      each_active([&](std::size_t lane) {
+        for (uint8_t key = 0; key < 16; ++key) {
+          if (pressed(lane, key)) {
+            V[X][lane] = key;
+            return;
+          }
+        }
+        prog_counter[lane] = static_cast<uint16_t>(prog_counter[lane] - 2);
+      });
+      break;
+    case opcode_id::OP_FX15:
+      for (std::size_t lane = 0; lane < Lanes; ++lane) {
+        delay_timer[lane] = select(on8[lane], VX[lane], delay_timer[lane]);
+      }
+      break;
+    case opcode_id::OP_FX18:
+      for (std::size_t lane = 0; lane < Lanes; ++lane) {
+        sound_timer[lane] = select(on8[lane], VX[lane], sound_timer[lane]);
+      }
+      break;
+    case opcode_id::OP_FX1E:
+      for (std::size_t lane = 0; lane < Lanes; ++lane) {
+        I[lane] = select(on16[lane], static_cast<uint16_t>(I[lane] + VX[lane]),
+                         I[lane]);
+      }
+      break;
+    case opcode_id::OP_FX29:
+      for (std::size_t lane = 0; lane < Lanes; ++lane) {
+        I[lane] = select(on16[lane], static_cast<uint16_t>(5 * VX[lane]),
+                         I[lane]);
+      }
+      break;
+    case opcode_id::OP_FX33:
+      track_store(X, X);
+      each_active([&](std::size_t lane) {
+        const auto value = VX[lane];
+        auto &mem = memory[lane];
+        mem[I[lane] & 0xFFFU] = static_cast<uint8_t>(value / 100);
+        mem[(I[lane] + 1U) & 0xFFFU] = static_cast<uint8_t>(value / 10 % 10);
+        mem[(I[lane] + 2U) & 0xFFFU] = static_cast<uint8_t>(value % 10);
+      });
+      break;
+    case opcode_id::OP_FX55:
+      track_store(0, X);
+      each_active([&](std::size_t lane) {
+        for (std::size_t i = 0; i <= X; ++i) {
+          memory[lane][(I[lane] + i) & 0xFFFU] = V[i][lane];
+        }
+        I[lane] = static_cast<uint16_t>(I[lane] + X + 1);
+      });
+      break;
+    case opcode_id::OP_FX65:
+      each_active([&](std::size_t lane) {
+        for (std::size_t i = 0; i <= X; ++i) {
+          V[i][lane] = memory[lane][(I[lane] + i) & 0xFFFU];
+        }
+        I[lane] = static_cast<uint16_t>(I[lane] + X + 1);
+      });
+      break;
+    case opcode_id::UNKNOWN:
+      each_active([&](std::size_t lane) {
+        std::fprintf(stderr, "Unrecognized opcode: %#x \n",
+                     read_opcode(lane, prog_counter[lane] - 2U));
+      });
+      break;
+    }
+  }
+
+  // Called before a store of V[first] to V[last] (or bytes made from
+  // them) at I. The memories stay the same only when every running lane
+  // stores the same values at the same address
+  void track_store(const std::size_t first, const std::size_t last) {
+    if (!same_memory) {
+      return;
+    }
+    if (active != running) {
+      same_memory = false;
+      return;
+    }
+    std::size_t leader = 0;
+    while (((active >> leader) & 1U) == 0) {
+      ++leader;
+    }
+    uint16_t apart = 0;
+    for (std::size_t lane = 0; lane < Lanes; ++lane) {
+      apart |= static_cast<uint16_t>((I[lane] ^ I[leader]) & on16[lane]);
+      for (std::size_t x = first; x <= last; ++x) {
+        apart |= static_cast<uint16_t>((V[x][lane] ^ V[x][leader]) &
+                                       on8[lane]);
+      }
+    }
+    same_memory = apart == 0;
+  }
+
+  [[nodiscard]] bool pressed(const std::size_t lane, const uint8_t key) const {
+    return ((static_cast<unsigned>(keys[lane]) >> (key & 0xFU)) & 1U) != 0;
+  }
+
+  // Same clipping and wrapping as chip8::op_DXYN
+  void draw(const std::size_t lane, const decoded_opcode &instr) {
+    const auto x = static_cast<std::size_t>(V[instr.X][lane] % display_x);
+    const auto y = static_cast<std::size_t>(V[instr.Y][lane] % display_y);
+    const auto rows = std::min<std::size_t>(instr.N, display_y - y);
+    uint64_t collision = 0;
+    for (std::size_t row = 0; row < rows; ++row) {
+      const uint8_t sprite = memory[lane][(I[lane] + row) & 0xFFFU];
+      const uint64_t bits = (static_cast<uint64_t>(sprite) << 56U) >> x;
+      auto &line = display[lane][y + row];
+      collision |= line & bits;
+      line ^= bits;
+    }
+    V[0xF][lane] = (collision != 0) ? 1 : 0;
+  }
+
+  alignas(64) std::array<lanes_of<uint8_t>, 16> V{};
+  alignas(64) lanes_of<uint16_t> I{};
+  alignas(64) lanes_of<uint16_t> prog_counter{};
+  lanes_of<uint8_t> delay_timer{};
+  lanes_of<uint8_t> sound_timer{};
+  lanes_of<uint32_t> timer_phase{};
+  lanes_of<uint32_t> rng{};
+  lanes_of<uint16_t> keys{};
+  lanes_of<uint8_t> stack_pointer{};
+  lanes_of<fault> error{};
+  // All bits set in the lanes of the group being executed
+  lanes_of<uint8_t> on8{};
+  lanes_of<uint16_t> on16{};
+  lane_mask active{0};
+  // Lanes that have not faulted, and the same as all bits per lane
+  lane_mask running{0};
+  lanes_of<uint16_t> running16{};
+  // Every running lane has the same memory, so equal program counters
+  // mean equal opcodes
+  bool same_memory{true};
+  // Only ever touched one lane at a time
+  lanes_of<std::array<uint16_t, stack_depth>> hw_stack{};
+  lanes_of<std::array<uint64_t, display_y>> display{};
+  lanes_of<std::array<uint8_t, 4096>> memory{};
+  uint32_t clock_hz{default_clock_hz};
+  std::size_t dispatches{0};
+};
+
+#endif // LOCKSTEP_CHIP8_H_
@@ -0,0 +1,82 @@
+#ifndef MOVIE_H_
+#define MOVIE_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+#include "chip8.hpp"
+
+// A movie is the keypad mask of every emulated frame (one run_frame() call)
+// together with everything else the run depends on. Replaying it from
+// power on reproduces the recorded run exactly. The file is this header
+// followed by runs of frames with the same keys, written like snapshots in
+// host byte order
+static constexpr uint32_t movie_magic = 0x564D3843; // "C8MV"
+static constexpr uint16_t movie_version = 1;
+struct movie_header {
+  uint32_t magic{movie_magic};
+  uint16_t version{movie_version};
+  uint16_t reserved{0};
+  uint32_t clock_hz{default_clock_hz};
+  uint32_t seed{default_rng_seed};
+  // fnv1a of the whole memory right after loading the ROM
+  uint64_t rom_hash{0};
+};
+
+// Identifies the loaded ROM, call it before running anything
+[[nodiscard]] uint64_t rom_hash(const chip8_state &state);
+
+// Runs are collected in a fixed chunk and appended to the file whenever it
+// fills up, the frames are never all held in memory
+static constexpr std::size_t movie_chunk_runs = 256;
+
+class movie_writer {
+public:
+  movie_writer(const std::string &file_name, const movie_header &header);
+  movie_writer(const movie_writer &) = delete;
+  movie_writer &operator=(const movie_writer &) = delete;
+  ~movie_writer();
+  // Keys held during the next frame
+  void record(uint16_t keys);
+  // Writes out everything recorded so far
+  void flush();
+
+private:
+  struct run {
+    uint16_t keys;
+    uint16_t frames;
+  };
+  void end_run();
+
+  std::ofstream file;
+  std::array<run, movie_chunk_runs> chunk{};
+  std::size_t chunk_used{0};
+  run current{0, 0};
+};
+
+class movie_reader {
+public:
+  explicit movie_reader(const std::string &file_name);
+  [[nodiscard]] const movie_header &header() const;
+  // Keys of the next frame, false once the movie is over
+  bool next(uint16_t &keys);
+
+private:
+  struct run {
+    uint16_t keys;
+    uint16_t frames;
+  };
+  bool read_chunk();
+
+  std::ifstream file;
+  movie_header info;
+  std::array<run, movie_chunk_runs> chunk{};
+  std::size_t chunk_used{0};
+  std::size_t chunk_pos{0};
+  run current{0, 0};
+};
+
+#endif // MOVIE_H_
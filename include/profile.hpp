@@ -0,0 +1,52 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+
+#include "decoder.hpp"
+
+// Hot path counters, to see what a ROM mix spends its instructions on.
+// Only CHIP8_PROFILING builds (ENABLE_PROFILING) count, every other build
+// compiles the counting away
+#ifdef CHIP8_PROFILING
+static constexpr bool profiling = true;
+#else
+static constexpr bool profiling = false;
+#endif
+
+// Bucket n holds the frames that ran [2^(n-1), 2^n) instructions, bucket 0
+// the frames that ran none
+static constexpr std::size_t frame_buckets = 33;
+
+struct chip8_profile {
+  // Executed instructions by opcode_id
+  std::array<uint64_t, opcode_count> opcodes{0};
+  // Executed instructions by the address they were fetched from
+  std::array<uint64_t, 4096> prog_counters{0};
+  // Sprite pixels DXYN drew, clipped rows left out
+  uint64_t sprite_pixels{0};
+  // Keypad reads by EX9E, EXA1 and every FX0A wait
+  uint64_t key_polls{0};
+  // Emulated frames, one per 60 Hz timer tick, by instructions run
+  std::array<uint64_t, frame_buckets> frame_instructions{0};
+  // Instructions of the frame that is still running
+  uint32_t current_frame{0};
+};
+
+constexpr std::size_t frame_bucket(uint32_t instructions) noexcept {
+  std::size_t bucket = 0;
+  for (; instructions != 0; instructions >>= 1U) {
+    ++bucket;
+  }
+  return bucket;
+}
+
+// The exporters are provided by the chip8_profile library.
+// Every counter, the per address ones only where they are not zero
+void write_profile_json(std::ostream &out, const chip8_profile &profile);
+// One "kind,key,count" row per counter, same selection as the JSON
+void write_profile_csv(std::ostream &out, const chip8_profile &profile);
+
+#endif // PROFILE_H_
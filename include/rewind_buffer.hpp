@@ -0,0 +1,49 @@
+#ifndef REWIND_BUFFER_H_
+#define REWIND_BUFFER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "chip8.hpp"
+
+// History of emulator states for stepping backwards, newest first.
+// Every interval frames the whole state is stored, the frames in
+// between only keep the bytes that differ from their keyframe (XOR, then
+// run length encoded). All memory is allocated up front, once it is full
+// the oldest keyframe and its deltas are dropped together
+class rewind_buffer {
+public:
+  rewind_buffer(std::size_t bytes, std::size_t max_frames,
+                std::size_t interval = 60);
+  void push(const chip8_state &state);
+  // Removes the newest frame and writes it to state, false when empty
+  bool pop(chip8_state &state);
+  void clear();
+  [[nodiscard]] std::size_t size() const;
+  [[nodiscard]] std::size_t bytes_used() const;
+
+private:
+  struct entry {
+    std::size_t offset{0};
+    std::size_t length{0};
+    // Sequence number of the keyframe this frame is relative to, its own
+    // for keyframes
+    std::size_t keyframe{0};
+  };
+  [[nodiscard]] entry &at(std::size_t seq);
+  [[nodiscard]] std::size_t encode_delta(const chip8_state &state,
+                                         const uint8_t *keyframe);
+  [[nodiscard]] std::size_t allocate(std::size_t length, std::size_t protect);
+  void drop_oldest_group();
+
+  std::vector<uint8_t> storage;
+  std::vector<entry> entries;
+  std::vector<uint8_t> scratch;
+  std::size_t keyframe_interval;
+  std::size_t first_seq{0};
+  std::size_t next_seq{0};
+  std::size_t used{0};
+};
+
+#endif // REWIND_BUFFER_H_
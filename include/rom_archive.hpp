@@ -0,0 +1,54 @@
+#ifndef ROM_ARCHIVE_H_
+#define ROM_ARCHIVE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Many ROMs packed into one file, so a corpus is opened and mapped once
+// instead of file by file (see rom_store::add_archive). The file is the
+// header, count index entries, the names and then the ROM data. ROMs with
+// the same content share their data. Written like snapshots, in host byte
+// order
+static constexpr uint32_t archive_magic = 0x4B503843; // "C8PK"
+static constexpr uint16_t archive_version = 1;
+struct archive_header {
+  uint32_t magic{archive_magic};
+  uint16_t version{archive_version};
+  uint16_t reserved{0};
+  uint32_t count{0};
+  // Keeps the index 8 byte aligned
+  uint32_t reserved2{0};
+};
+
+struct archive_entry {
+  // fnv1a of the ROM data
+  uint64_t hash{0};
+  // Offsets are from the start of the file
+  uint32_t offset{0};
+  uint32_t length{0};
+  uint32_t name_offset{0};
+  uint16_t name_length{0};
+  // Quirk profile the ROM was written for, 0 for plain CHIP8
+  uint8_t quirks{0};
+  uint8_t reserved{0};
+  // Recommended instruction clock, 0 for the runner's default
+  uint32_t clock_hz{0};
+  uint32_t reserved2{0};
+};
+
+// What goes into an archive
+struct archive_rom {
+  std::string name;
+  std::vector<uint8_t> data;
+  uint32_t clock_hz{0};
+  uint8_t quirks{0};
+};
+
+// Throws std::length_error for ROMs that are empty or larger than
+// max_rom_size
+void write_archive(const std::string &file_name,
+                   const std::vector<archive_rom> &roms);
+
+#endif // ROM_ARCHIVE_H_
@@ -0,0 +1,74 @@
+#ifndef ROM_STORE_H_
+#define ROM_STORE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "chip8.hpp"
+
+// One distinct ROM image, pointing into a read-only file mapping
+struct rom_entry {
+  const uint8_t *data{nullptr};
+  std::size_t size{0};
+  // fnv1a of the image
+  uint64_t hash{0};
+};
+
+// Where a ROM came from and how it wants to be run
+struct rom_info {
+  std::string name;
+  // 0 when the runner's default should be used
+  uint32_t clock_hz{0};
+  // See archive_entry
+  uint8_t quirks{0};
+};
+
+// Read-only ROM images for batch runs. Files are memory mapped instead of
+// read, and ROMs with the same content share a single image, so loading
+// one into a machine is one bounded copy with no allocation or stream
+class rom_store {
+public:
+  rom_store() = default;
+  rom_store(const rom_store &) = delete;
+  rom_store &operator=(const rom_store &) = delete;
+  ~rom_store();
+
+  // Returns the index of the new ROM. Throws std::length_error for empty
+  // files and files larger than max_rom_size
+  std::size_t add_file(const std::string &file_name);
+  // Adds every ROM of an archive written by write_archive, all pointing
+  // into one mapping of the file. Returns the index of the first one.
+  // Throws std::invalid_argument for files that are not intact archives
+  std::size_t add_archive(const std::string &file_name);
+  // ROMs added so far, duplicates included
+  [[nodiscard]] std::size_t size() const;
+  // Distinct images among them
+  [[nodiscard]] std::size_t unique_count() const;
+  [[nodiscard]] const rom_entry &get(std::size_t index) const;
+  [[nodiscard]] const rom_info &info(std::size_t index) const;
+  // The machine keeps pointing into the store for reset(), so the store
+  // has to outlive it or its next load
+  void load(std::size_t index, chip8 &machine) const;
+
+private:
+  struct mapping {
+    void *address;
+    std::size_t length;
+  };
+  [[nodiscard]] static mapping map_file(const std::string &file_name);
+  static void unmap(const mapping &region);
+  // Index of the image with this content, a new one when there is none
+  std::size_t find_or_add(const rom_entry &image, bool &added);
+
+  std::vector<mapping> mappings;
+  std::vector<rom_entry> images;
+  // Image and description of every added ROM
+  std::vector<std::size_t> roms;
+  std::vector<rom_info> infos;
+  std::unordered_multimap<uint64_t, std::size_t> by_hash;
+};
+
+#endif // ROM_STORE_H_
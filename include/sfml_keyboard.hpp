@@ -0,0 +1,10 @@
+#ifndef SFML_KEYBOARD_H_
+#define SFML_KEYBOARD_H_
+
+#include <SFML/Window/Keyboard.hpp>
+
+// CHIP8 keypad index of a host key, -1 for keys that are not mapped.
+// The keypad sits on 5678 / TYUI / GHJK / BNM,
+int keypad_index(sf::Keyboard::Key key);
+
+#endif // SFML_KEYBOARD_H_
@@ -0,0 +1,44 @@
+#ifndef TRIPLE_BUFFER_H_
+#define TRIPLE_BUFFER_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Single producer, single consumer hand-off of whole values without locks.
+// The producer always has a buffer to write into and the consumer always
+// sees the latest published one, intermediate values are dropped
+template <typename T> class triple_buffer {
+public:
+  // Producer side
+  T &write_buffer() { return buffers[back]; }
+  void publish() {
+    const auto previous = middle.exchange(
+        static_cast<uint8_t>(back | fresh_bit), std::memory_order_acq_rel);
+    back = previous & index_mask;
+  }
+
+  // Consumer side, true when something was published since the last call
+  bool update() {
+    if ((middle.load(std::memory_order_relaxed) & fresh_bit) == 0) {
+      return false;
+    }
+    const auto previous = middle.exchange(front, std::memory_order_acq_rel);
+    front = previous & index_mask;
+    return true;
+  }
+  const T &read_buffer() const { return buffers[front]; }
+
+private:
+  static constexpr uint8_t index_mask = 0x3;
+  static constexpr uint8_t fresh_bit = 0x4;
+
+  std::array<T, 3> buffers{};
+  // Index of the buffer in between, plus fresh_bit while the consumer
+  // has not picked it up yet
+  alignas(64) std::atomic<uint8_t> middle{1};
+  alignas(64) uint8_t back{0};
+  alignas(64) uint8_t front{2};
+};
+
+#endif // TRIPLE_BUFFER_H_
@@ -1,10 +1,10 @@
 #include "chip8.hpp"
 #include <algorithm>
+#include <cstring>
+#include <cstdio>
 #include <fstream>
-#include <random>
-
-#include "fmt/format.h"
-#include <SFML/Window/Keyboard.hpp>
+#include <stdexcept>
+#include <utility>
 
 struct BCD_t {
   uint8_t MSB;
@@ -12,47 +12,6 @@ struct BCD_t {
   uint8_t LSB;
 };
 
-// Mask function to get the first Nibble 0xN000
-// example: input is 0x6133, output will be 0x6000
-static constexpr uint16_t first_nibble(const uint16_t opcode) noexcept {
-  return (opcode & 0xF000U);
-}
-
-// Mask function to get the second Nibble 0x0N00
-// example: input is 0x6133, output will be 0x0100
-static constexpr uint16_t second_nibble(const uint16_t opcode) noexcept {
-  return (opcode & 0x0F00U);
-}
-
-// Mask function to get the third Nibble 0x00N0
-// example: input is 0x6133, output will be 0x0030
-static constexpr uint8_t third_nibble(const uint16_t opcode) noexcept {
-  return (opcode & 0x00F0U);
-}
-
-// Mask function to get the last Nibble 0x000N
-// example: input is 0x6133, output will be 0x0003
-static constexpr uint8_t last_nibble(const uint16_t opcode) noexcept {
-  return (opcode & 0x000FU);
-}
-// Mask function to get the last two nibbles 0x00NN
-// example: input is 0x6133, output will be 0x0033
-static constexpr uint8_t last_two_nibbles(const uint16_t opcode) noexcept {
-  return (opcode & 0x00FFU);
-}
-
-// Mask function to get the last three nibbles 0x0NNN
-// example: input is 0x6133, output will be 0x0133
-static constexpr uint16_t last_three_nibbles(const uint16_t opcode) noexcept {
-  return (opcode & 0x0FFFU);
-}
-// Mask function to get the last two nibbles 0x00NN
-// example: input is 0x6133, output will be 0x0100
-static constexpr std::pair<uint8_t, uint8_t>
-get_XY_nibbles(const uint16_t opcode) noexcept {
-  return {(second_nibble(opcode) >> 8), (third_nibble(opcode) >> 4)};
-}
-
 static constexpr BCD_t parse_BCD(const uint8_t number) {
 
   BCD_t BCD{0, 0, 0};
@@ -82,502 +41,803 @@ static constexpr std::array<uint8_t, 80> chip8_fonts = {
 };
 
 chip8::chip8() {
-  std::copy_n(chip8_fonts.begin(), chip8_fonts.size(), memory.begin());
+  std::copy_n(chip8_fonts.begin(), chip8_fonts.size(), state.memory.begin());
+  if constexpr (profiling) {
+    profile = std::make_unique<chip8_profile>();
+  }
 }
 
+chip8::chip8(backend selected) : chip8{} { engine = selected; }
+
 chip8::chip8(std::unique_ptr<keyboard> keyPtr) : chip8{} {
   numpad = std::move(keyPtr);
 }
 
+chip8::chip8(std::unique_ptr<keyboard> keyPtr, backend selected)
+    : chip8{std::move(keyPtr)} {
+  engine = selected;
+}
+
+void chip8::load_memory(const uint8_t *rom, const std::size_t size) {
+  if (size > max_rom_size) {
+    throw std::length_error("ROM does not fit into program memory");
+  }
+  std::copy_n(rom, size, rom_image.begin());
+  rom_view = nullptr;
+  rom_size = size;
+  install_rom();
+}
+
+void chip8::load_mapped(const uint8_t *rom, const std::size_t size) {
+  if (size > max_rom_size) {
+    throw std::length_error("ROM does not fit into program memory");
+  }
+  rom_view = rom;
+  rom_size = size;
+  install_rom();
+}
+
 void chip8::load_memory(const std::vector<uint8_t> &rom_opcodes) {
-  std::copy_n(rom_opcodes.begin(), rom_opcodes.size(),
-              memory.begin() + prog_mem_begin);
+  load_memory(rom_opcodes.data(), rom_opcodes.size());
 }
 
 void chip8::load_memory(const std::string &file_name) {
   std::ifstream file;
-  std::vector<char> rom;
   file.open(file_name.c_str(), std::ios::binary | std::ios::ate);
-
-  if (file.is_open()) {
-    std::streampos size = file.tellg();
-    rom.resize(static_cast<std::size_t>(size));
-    file.seekg(0, std::ios::beg);
-    file.read(rom.data(), size);
-    file.close();
-  } else {
+  if (!file.is_open()) {
     throw std::invalid_argument("Given filename " + file_name +
                                 " does not exist!");
   }
-  std::copy_n(rom.begin(), rom.size(), memory.begin() + prog_mem_begin);
+  const auto size = static_cast<std::size_t>(file.tellg());
+  if (size > max_rom_size) {
+    throw std::length_error(file_name + " does not fit into program memory");
+  }
+  file.seekg(0, std::ios::beg);
+  // Straight into the ROM copy, no buffer in between
+  file.read(reinterpret_cast<char *>(rom_image.data()),
+            static_cast<std::streamsize>(size));
+  rom_view = nullptr;
+  rom_size = size;
+  install_rom();
+}
+
+const uint8_t *chip8::rom_bytes() const {
+  return (rom_view != nullptr) ? rom_view : rom_image.data();
+}
+
+void chip8::install_rom() {
+  const auto *rom = rom_bytes();
+  const auto program = state.memory.begin() + prog_mem_begin;
+  // Reloading the program that is already in memory, as batch runs do,
+  // keeps everything decoded from it
+  if (!std::equal(rom, rom + rom_size, program)) {
+    std::copy_n(rom, rom_size, program);
+    decoded_valid.fill(false);
+    flush_blocks();
+  }
+  // The new program starts from its first instruction, even when the
+  // last one faulted
+  state.prog_counter = prog_mem_begin;
+  state.stack_pointer = 0;
+  state.error = fault::none;
+}
+
+void chip8::reset() {
+  chip8_state power_on{};
+  std::copy_n(chip8_fonts.begin(), chip8_fonts.size(), power_on.memory.begin());
+  std::copy_n(rom_bytes(), rom_size, power_on.memory.begin() + prog_mem_begin);
+  power_on.rng = rng_seed;
+  load_state(power_on);
 }
 
-std::array<uint8_t, 16> chip8::get_V_registers() const { return V; }
-std::array<bool, 16> chip8::get_Keys_array() const { return Keys; }
-std::array<uint8_t, 4096> chip8::get_memory_dump() const { return memory; }
-std::stack<uint16_t> chip8::get_stack() const { return hw_stack; }
+std::size_t chip8::save_state(uint8_t *buffer, const std::size_t size) const {
+  if (size < snapshot_size) {
+    throw std::length_error("Snapshot buffer is too small");
+  }
+  const snapshot_header header{snapshot_magic, snapshot_version, 0,
+                               sizeof(chip8_state)};
+  std::memcpy(buffer, &header, sizeof(header));
+  std::memcpy(buffer + sizeof(header), &state, sizeof(state));
+  return snapshot_size;
+}
 
-uint16_t chip8::get_prog_counter() const { return prog_counter; }
-uint8_t chip8::get_delay_counter() const { return delay_timer; }
-uint8_t chip8::get_sound_counter() const { return sound_timer; }
-std::string chip8::get_instruction() const { return instruction; }
-uint16_t chip8::get_I_register() const { return I; }
+void chip8::load_state(const uint8_t *buffer, const std::size_t size) {
+  snapshot_header header{};
+  if (size >= snapshot_size) {
+    std::memcpy(&header, buffer, sizeof(header));
+  }
+  if (header.magic != snapshot_magic || header.version != snapshot_version ||
+      header.state_size != sizeof(chip8_state)) {
+    throw std::invalid_argument("Not a snapshot of this emulator build");
+  }
+  chip8_state snapshot;
+  std::memcpy(&snapshot, buffer + sizeof(header), sizeof(snapshot));
+  load_state(snapshot);
+}
+
+void chip8::load_state(const chip8_state &snapshot) {
+  // Restoring a snapshot of the same program is the common case, the
+  // decoded caches are only dropped when the memory differs
+  const bool same_memory = snapshot.memory == state.memory;
+  state = snapshot;
+  if (!same_memory) {
+    decoded_valid.fill(false);
+    flush_blocks();
+  }
+  // The trace belongs to the timeline that was left
+  trace_size = 0;
+  dirty_rows = ~0U;
+  isDisplaySet = false;
+}
+
+const chip8_state &chip8::get_state() const { return state; }
+std::array<uint8_t, 16> chip8::get_V_registers() const { return state.V; }
+std::array<bool, 16> chip8::get_Keys_array() const {
+  std::array<bool, 16> keys{false};
+  for (std::size_t key = 0; key < keys.size(); ++key) {
+    keys[key] = ((state.keys >> key) & 1U) != 0;
+  }
+  return keys;
+}
+void chip8::set_keys(const uint16_t mask) { state.keys = mask; }
+void chip8::press_key(const uint8_t key) {
+  state.keys = static_cast<uint16_t>(state.keys | (1U << (key & 0xFU)));
+}
+void chip8::release_key(const uint8_t key) {
+  state.keys = static_cast<uint16_t>(state.keys & ~(1U << (key & 0xFU)));
+}
+std::array<uint8_t, 4096> chip8::get_memory_dump() const {
+  return state.memory;
+}
+std::stack<uint16_t> chip8::get_stack() const {
+  std::stack<uint16_t> hw_stack;
+  for (std::size_t level = 0; level < state.stack_pointer; ++level) {
+    hw_stack.push(state.hw_stack[level]);
+  }
+  return hw_stack;
+}
+fault chip8::get_fault() const { return state.error; }
+
+uint16_t chip8::get_prog_counter() const { return state.prog_counter; }
+uint8_t chip8::get_delay_counter() const { return state.delay_timer; }
+uint8_t chip8::get_sound_counter() const { return state.sound_timer; }
+trace_record chip8::get_trace(const std::size_t age) const {
+  return trace[(trace_head - 1 - age) % trace.size()];
+}
+std::size_t chip8::get_trace_size() const { return trace_size; }
+uint16_t chip8::get_I_register() const { return state.I; }
 bool chip8::get_display_flag() const { return isDisplaySet; }
+uint32_t chip8::present() { return std::exchange(dirty_rows, 0U); }
+const chip8_profile &chip8::get_profile() const {
+  static const chip8_profile disabled{};
+  return profile ? *profile : disabled;
+}
+void chip8::reset_profile() {
+  if (profile) {
+    *profile = chip8_profile{};
+  }
+}
 std::array<uint8_t, display_size> chip8::get_display_pixels() const {
-  return display;
+  std::array<uint8_t, display_size> pixels{0};
+  for (std::size_t y = 0; y < display_y; ++y) {
+    for (std::size_t x = 0; x < display_x; ++x) {
+      pixels[x + (display_x * y)] = is_pixel_set(state, x, y) ? 1 : 0;
+    }
+  }
+  return pixels;
 }
 
-void chip8::step_one_cycle() {
-  // The memory is read in big endian, i.e., MSB first
-  auto opcode = static_cast<uint16_t>((memory[prog_counter] << 8) |
-                                      (memory[prog_counter + 1U]));
+
+// Indexed by opcode_id, so the order has to follow decoder.hpp
+const std::array<chip8::threaded_handler_t, opcode_count>
+    chip8::threaded_handlers = {
+        &threaded_thunk<&chip8::op_00E0>, &threaded_thunk<&chip8::op_00EE>,
+        &threaded_thunk<&chip8::op_1NNN>, &threaded_thunk<&chip8::op_2NNN>,
+        &threaded_thunk<&chip8::op_3XNN>, &threaded_thunk<&chip8::op_4XNN>,
+        &threaded_thunk<&chip8::op_5XY0>, &threaded_thunk<&chip8::op_6XNN>,
+        &threaded_thunk<&chip8::op_7XNN>, &threaded_thunk<&chip8::op_8XY0>,
+        &threaded_thunk<&chip8::op_8XY1>, &threaded_thunk<&chip8::op_8XY2>,
+        &threaded_thunk<&chip8::op_8XY3>, &threaded_thunk<&chip8::op_8XY4>,
+        &threaded_thunk<&chip8::op_8XY5>, &threaded_thunk<&chip8::op_8XY6>,
+        &threaded_thunk<&chip8::op_8XY7>, &threaded_thunk<&chip8::op_8XYE>,
+        &threaded_thunk<&chip8::op_9XY0>, &threaded_thunk<&chip8::op_ANNN>,
+        &threaded_thunk<&chip8::op_BNNN>, &threaded_thunk<&chip8::op_CXNN>,
+        &threaded_thunk<&chip8::op_DXYN>, &threaded_thunk<&chip8::op_EX9E>,
+        &threaded_thunk<&chip8::op_EXA1>, &threaded_thunk<&chip8::op_FX07>,
+        &threaded_thunk<&chip8::op_FX0A>, &threaded_thunk<&chip8::op_FX15>,
+        &threaded_thunk<&chip8::op_FX18>, &threaded_thunk<&chip8::op_FX1E>,
+        &threaded_thunk<&chip8::op_FX29>, &threaded_thunk<&chip8::op_FX33>,
+        &threaded_thunk<&chip8::op_FX55>, &threaded_thunk<&chip8::op_FX65>,
+        &threaded_thunk<&chip8::op_unknown>};
+
+// The switch over the dense opcode_id compiles to a single jump table and
+// lets the compiler inline every handler into it
+void chip8::execute(const decoded_opcode &instr) {
+  switch (instr.id) {
+  case opcode_id::OP_00E0: op_00E0(instr); break;
+  case opcode_id::OP_00EE: op_00EE(instr); break;
+  case opcode_id::OP_1NNN: op_1NNN(instr); break;
+  case opcode_id::OP_2NNN: op_2NNN(instr); break;
+  case opcode_id::OP_3XNN: op_3XNN(instr); break;
+  case opcode_id::OP_4XNN: op_4XNN(instr); break;
+  case opcode_id::OP_5XY0: op_5XY0(instr); break;
+  case opcode_id::OP_6XNN: op_6XNN(instr); break;
+  case opcode_id::OP_7XNN: op_7XNN(instr); break;
+  case opcode_id::OP_8XY0: op_8XY0(instr); break;
+  case opcode_id::OP_8XY1: op_8XY1(instr); break;
+  case opcode_id::OP_8XY2: op_8XY2(instr); break;
+  case opcode_id::OP_8XY3: op_8XY3(instr); break;
+  case opcode_id::OP_8XY4: op_8XY4(instr); break;
+  case opcode_id::OP_8XY5: op_8XY5(instr); break;
+  case opcode_id::OP_8XY6: op_8XY6(instr); break;
+  case opcode_id::OP_8XY7: op_8XY7(instr); break;
+  case opcode_id::OP_8XYE: op_8XYE(instr); break;
+  case opcode_id::OP_9XY0: op_9XY0(instr); break;
+  case opcode_id::OP_ANNN: op_ANNN(instr); break;
+  case opcode_id::OP_BNNN: op_BNNN(instr); break;
+  case opcode_id::OP_CXNN: op_CXNN(instr); break;
+  case opcode_id::OP_DXYN: op_DXYN(instr); break;
+  case opcode_id::OP_EX9E: op_EX9E(instr); break;
+  case opcode_id::OP_EXA1: op_EXA1(instr); break;
+  case opcode_id::OP_FX07: op_FX07(instr); break;
+  case opcode_id::OP_FX0A: op_FX0A(instr); break;
+  case opcode_id::OP_FX15: op_FX15(instr); break;
+  case opcode_id::OP_FX18: op_FX18(instr); break;
+  case opcode_id::OP_FX1E: op_FX1E(instr); break;
+  case opcode_id::OP_FX29: op_FX29(instr); break;
+  case opcode_id::OP_FX33: op_FX33(instr); break;
+  case opcode_id::OP_FX55: op_FX55(instr); break;
+  case opcode_id::OP_FX65: op_FX65(instr); break;
+  case opcode_id::UNKNOWN: op_unknown(instr); break;
+  }
+}
+
+uint16_t chip8::read_opcode(const std::size_t addr) const {
+  // The memory is read in big endian, i.e., MSB first. Addresses wrap at
+  // the 4 KB boundary, so the opcode at 0xFFF ends with the byte at 0
+  return static_cast<uint16_t>((state.memory[addr & 0xFFFU] << 8) |
+                               (state.memory[(addr + 1) & 0xFFFU]));
+}
+
+const decoded_opcode &chip8::fetch_decoded() {
+  // Jumps to odd addresses are rare enough that they skip the cache
+  // and go straight to the decode table
+  if ((state.prog_counter & 1U) == 0) {
+    // Past 0xFFF the program counter keeps counting but reads wrap
+    const auto slot =
+        static_cast<std::size_t>(state.prog_counter >> 1) & 0x7FFU;
+    if (!decoded_valid[slot]) {
+      decoded_cache[slot] = lookup(read_opcode(state.prog_counter));
+      decoded_valid[slot] = true;
+    }
+    return decoded_cache[slot];
+  }
+  return lookup(read_opcode(state.prog_counter));
+}
+
+// Every store into memory has to go through here, otherwise a
+// self-modifying ROM would keep executing the stale decoded instruction
+void chip8::invalidate_decoded(const uint16_t addr, const std::size_t len) {
+  for (std::size_t byte = addr; byte < addr + len; ++byte) {
+    decoded_valid[(byte >> 1) & 0x7FF] = false;
+    // The block being executed may be the one that was just written to,
+    // so the threaded backend only flushes once the store has finished
+    blocks_stale = blocks_stale || is_block_code[byte & 0xFFF];
+  }
+}
+
+void chip8::begin_cycle() {
+  if constexpr (debug) {
+    // Only the raw opcode is kept, the text is produced by the
+    // disassembler when somebody actually looks at the trace
+    trace[trace_head % trace.size()] = {state.prog_counter,
+                                        read_opcode(state.prog_counter)};
+    ++trace_head;
+    trace_size = std::min(trace_size + 1, trace.size());
+  }
   // Each cycle reads two consecutive opcodes
   // -Wconversion requires this cast as 2 will be implicitly
   // turned to an int
-  prog_counter = static_cast<uint16_t>(prog_counter + 2);
+  state.prog_counter = static_cast<uint16_t>(state.prog_counter + 2);
+  isDisplaySet = false;
+}
 
-  if (delay_timer > 0) {
-    --delay_timer;
+// Called before begin_cycle, while the program counter still points at
+// the instruction
+void chip8::profile_cycle(const opcode_id id) {
+  ++profile->opcodes[static_cast<std::size_t>(id)];
+  ++profile->prog_counters[state.prog_counter & 0xFFFU];
+  ++profile->current_frame;
+}
+
+void chip8::end_cycle() {
+  // The timers count down at 60 Hz of emulated time, whatever the clock
+  // rate: every instruction advances the phase by timer_hz / clock_hz of
+  // a tick
+  state.timer_phase += timer_hz;
+  if (state.timer_phase >= clock_hz) {
+    state.timer_phase -= clock_hz;
+    if constexpr (profiling) {
+      ++profile->frame_instructions[frame_bucket(profile->current_frame)];
+      profile->current_frame = 0;
+    }
+    if (state.delay_timer > 0) {
+      --state.delay_timer;
+    }
+    if (state.sound_timer > 0) {
+      // Use SFML to BEEP
+      --state.sound_timer;
+    }
   }
-  if (sound_timer > 0) {
-    // Use SFML to BEEP
-    --sound_timer;
+}
+
+bool chip8::is_key_pressed(const uint8_t key) {
+  if constexpr (profiling) {
+    ++profile->key_polls;
   }
-  isDisplaySet = false;
-  switch (first_nibble(opcode)) {
-  // OPCODE 6XNN: Store number NN in register VX
-  case (0x6000): {
-    const auto Vx = static_cast<uint8_t>(second_nibble(opcode) >> 8);
-    V[Vx] = last_two_nibbles(opcode);
-    if constexpr (debug) {
-      instruction = fmt::format("6XNN: LD {0:#x}, {1:#x}", Vx, V[Vx]);
-    }
-    break;
+  if (numpad) {
+    const auto pressed = numpad->isKeyVxPressed(key);
+    numpad->clearKeyInput();
+    return pressed;
   }
-  case (0x8000): {
-    // OPCODE 8XY0 : Store the value of register VY in register VX
-    if (last_nibble(opcode) == 0) {
-      const auto [Vx, Vy] = get_XY_nibbles(opcode);
-      V[Vx] = V[Vy];
+  return ((state.keys >> (key & 0xFU)) & 1U) != 0;
+}
 
-      if constexpr (debug) {
-        instruction = fmt::format("8XY0: LD {0:#x}, {1:#x}", Vx, Vy);
-      }
-    }
-    // OPCODE 8XY4 : Add the value of register VY to register VX
-    // Set VF to 01 if a carry occurs else to 0
-    else if (last_nibble(opcode) == 4) {
-      const auto [Vx, Vy] = get_XY_nibbles(opcode);
-      const auto sum = static_cast<uint16_t>(V[Vy] + V[Vx]);
-      // mask the sum with 0b100000000 (0x100) to get the overflow bit
-      V[0xF] = static_cast<uint8_t>((sum & 0x100) >> 8);
-      V[Vx] = static_cast<uint8_t>(sum);
-
-      if constexpr (debug) {
-        instruction = fmt::format("8XY4: ADD {0:#x}, {1:#x}", Vx, Vy);
-      }
+std::pair<bool, uint8_t> chip8::first_pressed_key() {
+  if constexpr (profiling) {
+    ++profile->key_polls;
+  }
+  if (numpad) {
+    const auto pressed = numpad->whichKeyIndexIfPressed();
+    numpad->clearKeyInput();
+    return pressed;
+  }
+  for (uint8_t key = 0; key < 16; ++key) {
+    if (((state.keys >> key) & 1U) != 0) {
+      return {true, key};
     }
-    // OPCODE 8XY5 : Subtract the value of register VY from register VX
-    // Set VF to 01 if a borrow does not occur, else to 0
-    else if (last_nibble(opcode) == 5) {
-      const auto [Vx, Vy] = get_XY_nibbles(opcode);
-      if (V[Vx] > V[Vy]) {
-        V[0xF] = 1;
-      } else {
-        V[0xF] = 0;
-      }
-      V[Vx] = static_cast<uint8_t>(V[Vx] - V[Vy]);
+  }
+  return {false, 0};
+}
 
-      if constexpr (debug) {
-        instruction = fmt::format("8XY5: SUB {0:#x}, {1:#x}", Vx, Vy);
-      }
-    }
-    // OPCODE 8XY7 : Set register VX to the value of VY minus VX
-    // Set VF to 01 if a borrow does not occur, else to 0
-    else if (last_nibble(opcode) == 7) {
-      const auto [Vx, Vy] = get_XY_nibbles(opcode);
-      if (V[Vy] > V[Vx]) {
-        V[0xF] = 1;
-      } else {
-        V[0xF] = 0;
-      }
-      V[Vx] = static_cast<uint8_t>(V[Vy] - V[Vx]);
+void chip8::halt(const fault error) {
+  state.error = error;
+  // Leave the program counter on the faulting instruction
+  state.prog_counter = static_cast<uint16_t>(state.prog_counter - 2);
+}
 
-      if constexpr (debug) {
-        instruction = fmt::format("8XY7: SUBN {0:#x}, {1:#x}", Vx, Vy);
-      }
-    }
-    // OPCODE 8XY2 : Set VX to VX AND VY
-    else if (last_nibble(opcode) == 2) {
-      const auto [Vx, Vy] = get_XY_nibbles(opcode);
-      V[Vx] = V[Vx] & V[Vy];
+void chip8::step_one_cycle() {
+  if (state.error != fault::none) {
+    return;
+  }
+  const auto &instr = fetch_decoded();
+  if constexpr (profiling) {
+    profile_cycle(instr.id);
+  }
+  begin_cycle();
+  execute(instr);
+  end_cycle();
+}
 
-      if constexpr (debug) {
-        instruction = fmt::format("8XY2: AND {0:#x}, {1:#x}", Vx, Vy);
-      }
-    }
-    // OPCODE 8XY1 : Set VX to VX OR VY
-    else if (last_nibble(opcode) == 1) {
-      const auto [Vx, Vy] = get_XY_nibbles(opcode);
-      V[Vx] = V[Vx] | V[Vy];
+void chip8::set_clock_hz(const uint32_t hz) {
+  if (hz < timer_hz) {
+    throw std::invalid_argument("The clock can not be slower than the timers");
+  }
+  clock_hz = hz;
+  state.timer_phase %= clock_hz;
+  run_for_remainder = 0;
+}
 
-      if constexpr (debug) {
-        instruction = fmt::format("8XY1: OR {0:#x}, {1:#x}", Vx, Vy);
-      }
+uint32_t chip8::get_clock_hz() const { return clock_hz; }
+
+void chip8::seed_rng(const uint32_t seed) {
+  // xorshift never leaves the all zero state
+  rng_seed = (seed != 0) ? seed : default_rng_seed;
+  state.rng = rng_seed;
+}
+
+void chip8::run_frame() {
+  // Just enough instructions for the next timer tick, so frames and
+  // ticks stay aligned whatever the clock rate
+  run((clock_hz - state.timer_phase + timer_hz - 1) / timer_hz);
+}
+
+void chip8::run_for(const std::chrono::nanoseconds emulated_time) {
+  if (emulated_time.count() <= 0) {
+    return;
+  }
+  // The fraction of an instruction left over is carried to the next call
+  constexpr uint64_t ns_per_second = 1'000'000'000U;
+  const auto scaled =
+      static_cast<uint64_t>(emulated_time.count()) * clock_hz +
+      run_for_remainder;
+  run(static_cast<std::size_t>(scaled / ns_per_second));
+  run_for_remainder = scaled % ns_per_second;
+}
+
+void chip8::run(const std::size_t num_cycles) {
+  if (engine == backend::threaded) {
+    run_threaded(num_cycles);
+    return;
+  }
+  for (std::size_t cycle = 0; cycle < num_cycles; ++cycle) {
+    step_one_cycle();
+  }
+}
+
+// Every opcode that can move the program counter anywhere but the next
+// instruction ends a basic block. FX0A repeats itself while no key is down
+static constexpr bool ends_block(const opcode_id id) noexcept {
+  switch (id) {
+  case opcode_id::OP_00EE:
+  case opcode_id::OP_1NNN:
+  case opcode_id::OP_2NNN:
+  case opcode_id::OP_3XNN:
+  case opcode_id::OP_4XNN:
+  case opcode_id::OP_5XY0:
+  case opcode_id::OP_9XY0:
+  case opcode_id::OP_BNNN:
+  case opcode_id::OP_EX9E:
+  case opcode_id::OP_EXA1:
+  case opcode_id::OP_FX0A:
+    return true;
+  default:
+    return false;
+  }
+}
+
+chip8::block_ref chip8::compile_block(const uint16_t start) {
+  block_ref block{static_cast<uint32_t>(threaded_code.size()), 0};
+  auto addr = static_cast<std::size_t>(start);
+  // The last byte of memory can not hold a complete opcode
+  while (addr + 1 < state.memory.size()) {
+    const auto &instr = lookup(read_opcode(addr));
+    threaded_code.push_back(
+        {threaded_handlers[static_cast<std::size_t>(instr.id)], instr});
+    is_block_code[addr] = true;
+    is_block_code[addr + 1] = true;
+    ++block.length;
+    addr += 2;
+    if (ends_block(instr.id) || block.length == max_block_length) {
+      break;
     }
-    // OPCODE 8XY3 : Set VX to VX XOR VY
-    else if (last_nibble(opcode) == 3) {
-      const auto [Vx, Vy] = get_XY_nibbles(opcode);
-      V[Vx] = V[Vx] ^ V[Vy];
+  }
+  return block;
+}
 
-      if constexpr (debug) {
-        instruction = fmt::format("8XY3: XOR {0:#x}, {1:#x}", Vx, Vy);
+void chip8::flush_blocks() {
+  threaded_code.clear();
+  blocks.fill({});
+  is_block_code.fill(false);
+  blocks_stale = false;
+}
+
+void chip8::run_threaded(const std::size_t num_cycles) {
+  std::size_t cycle = 0;
+  // Only block terminators can fault, so checking between blocks is enough
+  while (cycle < num_cycles && state.error == fault::none) {
+    auto &block = blocks[state.prog_counter & 0xFFF];
+    if (block.length == 0) {
+      block = compile_block(state.prog_counter);
+      if (block.length == 0) {
+        // Nothing to translate at the very end of memory
+        step_one_cycle();
+        ++cycle;
+        continue;
       }
     }
-    // OPCODE 8XY6 : Store the value of register VY
-    // shifted right one bit in register VX
-    // Set register VF to the least significant
-    // bit prior to the shift
-    // Vy is first changed and then it is stored in Vx
-    else if (last_nibble(opcode) == 6) {
-      const auto [Vx, Vy] = get_XY_nibbles(opcode);
-      V[0xF] = V[Vy] & 0x01;
-      V[Vy] = static_cast<uint8_t>(V[Vy] >> 1);
-      V[Vx] = V[Vy];
-
-      if constexpr (debug) {
-        instruction = fmt::format("8XY6: SHR {0:#x}, {{,{1:#x}}}", Vx, Vy);
+    const auto *op = &threaded_code[block.first];
+    const auto *const block_end = op + block.length;
+    for (; op != block_end && cycle < num_cycles; ++op, ++cycle) {
+      if constexpr (profiling) {
+        profile_cycle(op->instr.id);
       }
-    }
-    // OPCODE 8XYE : Store the value of register VY
-    //  shifted left one bit in register VX
-    // Set register VF to the most significant
-    // bit prior to the shift
-    // Vy is first changed and then it is stored in Vx
-    else if (last_nibble(opcode) == 0xE) {
-      const auto [Vx, Vy] = get_XY_nibbles(opcode);
-      V[0xF] = static_cast<uint8_t>((V[Vy] & 0x80) >> 7);
-      V[Vy] = static_cast<uint8_t>(V[Vy] << 1);
-      V[Vx] = V[Vy];
-
-      if constexpr (debug) {
-        instruction = fmt::format("8XYE: SHL {0:#x}, {{,{1:#x}}}", Vx, Vy);
+      begin_cycle();
+      op->handler(*this, op->instr);
+      end_cycle();
+      if (blocks_stale) {
+        flush_blocks();
+        ++cycle;
+        break;
       }
-    } else {
-      fmt::print("Unrecognized opcode: {0:#x} \n", opcode);
     }
-    break;
-  }
-  // OPCODE 7XNN : Add NN to register VX
-  case (0x7000): {
-    const auto Vx = static_cast<uint8_t>(second_nibble(opcode) >> 8);
-    // static_cast replicates the actual CHIP8 adder where if a 8bit
-    // overflow happens the addition resets to 0 once the value crosses
-    // 255
-    const auto NN = V[Vx];
-    V[Vx] = static_cast<uint8_t>((last_two_nibbles(opcode) + NN));
-
-    if constexpr (debug) {
-      instruction = fmt::format("7XNN: ADD {0:#x}, {1:#x}", Vx, NN);
+  }
+}
+
+// OPCODE 00E0 : Clear display
+void chip8::op_00E0(const decoded_opcode & /*instr*/) {
+  for (std::size_t y = 0; y < display_y; ++y) {
+    if (state.display[y] != 0) {
+      dirty_rows |= 1U << y;
     }
-    break;
   }
-  // OPCODE CXNN : Set VX to a random number with a mask of NN
-  case (0xC000): {
-    const auto Vx = static_cast<uint8_t>(second_nibble(opcode) >> 8);
-    const uint8_t mask = last_two_nibbles(opcode);
-    std::random_device rseed;
-    std::mt19937 rgen(rseed()); // mersenne_twister
-    std::uniform_int_distribution<int> idist(0, 255);
+  state.display.fill(0);
+  isDisplaySet = true;
+}
 
-    V[Vx] = static_cast<uint8_t>(idist(rgen) & mask);
+// OPCODE 00EE : Return from a subroutine
+void chip8::op_00EE(const decoded_opcode & /*instr*/) {
+  if (state.stack_pointer == 0) {
+    halt(fault::stack_underflow);
+    return;
+  }
+  --state.stack_pointer;
+  state.prog_counter = state.hw_stack[state.stack_pointer];
+}
 
-    if constexpr (debug) {
-      instruction = fmt::format("CXNN: RND {0:#x}, {1:#x}", Vx, V[Vx]);
-    }
-    break;
+// OPCODE 1NNN : Jump to address NNN
+void chip8::op_1NNN(const decoded_opcode &instr) {
+  state.prog_counter = instr.NNN;
+}
+
+// OPCODE 2NNN : Execute subroutine starting at address NNN
+void chip8::op_2NNN(const decoded_opcode &instr) {
+  if (state.stack_pointer == state.hw_stack.size()) {
+    halt(fault::stack_overflow);
+    return;
   }
-  // OPCODE 1NNN : Jump to address NNN
-  case (0x1000): {
-    prog_counter = last_three_nibbles(opcode);
+  state.hw_stack[state.stack_pointer] = state.prog_counter;
+  ++state.stack_pointer;
+  state.prog_counter = instr.NNN;
+}
 
-    if constexpr (debug) {
-      instruction = fmt::format("1NNN: JMP {0:#x}", prog_counter);
-    }
-    break;
+// OPCODE 3XNN : Skip the following instruction
+// if the value of register VX equals NN
+void chip8::op_3XNN(const decoded_opcode &instr) {
+  if (state.V[instr.X] == instr.NN) {
+    state.prog_counter = static_cast<uint16_t>(state.prog_counter + 2) & 0x0FFF;
   }
-  // OPCODE BNNN : Jump to address NNN + V0
-  case (0xB000): {
-    prog_counter =
-        static_cast<uint16_t>(last_three_nibbles(opcode) + V[0]) & 0x0FFF;
+}
 
-    if constexpr (debug) {
-      instruction = fmt::format("BNNN: JMP {0:#x}, {1:#x}", V[0], prog_counter);
-    }
-    break;
+// OPCODE 4XNN : Skip the following instruction
+// if the value of register VX not equal to NN
+void chip8::op_4XNN(const decoded_opcode &instr) {
+  if (state.V[instr.X] != instr.NN) {
+    state.prog_counter = static_cast<uint16_t>(state.prog_counter + 2) & 0x0FFF;
   }
-  // OPCODE 2NNN : Execute subroutine starting at address NNN
-  case (0x2000): {
-    hw_stack.push(prog_counter);
-    prog_counter = last_three_nibbles(opcode) & 0x0FFF;
+}
 
-    if constexpr (debug) {
-      instruction = fmt::format("2NNN: CALL {0:#x}", prog_counter);
-    }
-    break;
+// OPCODE 5XY0 : Skip the following instruction if the value
+// of register VX is equal to the value of register VY
+void chip8::op_5XY0(const decoded_opcode &instr) {
+  if (state.V[instr.X] == state.V[instr.Y]) {
+    state.prog_counter = static_cast<uint16_t>(state.prog_counter + 2) & 0x0FFF;
   }
-  case (0x0000): {
-    // OPCODE 00EE : Return from a subroutine
-    if (last_two_nibbles(opcode) == 0xEE) {
-      prog_counter = hw_stack.top();
-      hw_stack.pop();
+}
 
-      if constexpr (debug) {
-        instruction = fmt::format("00EE: RET");
-      }
-    }
-    // OPCODE 00E0 : Clear display
-    else if (last_two_nibbles(opcode) == 0xE0) {
-      display = {0};
-      isDisplaySet = true;
+// OPCODE 6XNN: Store number NN in register VX
+void chip8::op_6XNN(const decoded_opcode &instr) {
+  state.V[instr.X] = instr.NN;
+}
 
-      if constexpr (debug) {
-        instruction = fmt::format("00E0: CLS");
-      }
-    } else {
-      fmt::print("Unrecognized opcode: {0:#x} \n", opcode);
-    }
-    break;
-  }
-  // OPCODE 3XNN : Skip the following instruction
-  // if the value of register VX equals NN
-  case (0x3000): {
-    const auto Vx = static_cast<uint8_t>(second_nibble(opcode) >> 8);
-    const uint8_t cmp_value = last_two_nibbles(opcode);
-    if (V[Vx] == cmp_value) {
-      prog_counter = static_cast<uint16_t>(prog_counter + 2) & 0x0FFF;
-    }
+// OPCODE 7XNN : Add NN to register VX
+void chip8::op_7XNN(const decoded_opcode &instr) {
+  // static_cast replicates the actual CHIP8 adder where if a 8bit
+  // overflow happens the addition resets to 0 once the value crosses
+  // 255
+  state.V[instr.X] = static_cast<uint8_t>((state.V[instr.X] + instr.NN));
+}
 
-    if constexpr (debug) {
-      instruction = fmt::format("3XNN: SE {0:#x}, {1:#x}", Vx, cmp_value);
-    }
-    break;
-  }
-  // OPCODE 4XNN : Skip the following instruction
-  // if the value of register VX not equal to NN
-  case (0x4000): {
-    const auto Vx = static_cast<uint8_t>(second_nibble(opcode) >> 8);
-    const uint8_t cmp_value = last_two_nibbles(opcode);
-    if (V[Vx] != cmp_value) {
-      prog_counter = static_cast<uint16_t>(prog_counter + 2) & 0x0FFF;
-    }
+// OPCODE 8XY0 : Store the value of register VY in register VX
+void chip8::op_8XY0(const decoded_opcode &instr) {
+  state.V[instr.X] = state.V[instr.Y];
+}
 
-    if constexpr (debug) {
-      instruction = fmt::format("4XNN: SNE {0:#x}, {1:#x}", Vx, cmp_value);
-    }
-    break;
-  }
-  // OPCODE 5XNN : Skip the following instruction if the value
-  // of register VX is equal to the value of register VY
-  case (0x5000): {
-    const auto [Vx, Vy] = get_XY_nibbles(opcode);
-    if (V[Vx] == V[Vy]) {
-      prog_counter = static_cast<uint16_t>(prog_counter + 2) & 0x0FFF;
-    }
+// OPCODE 8XY1 : Set VX to VX OR VY
+void chip8::op_8XY1(const decoded_opcode &instr) {
+  state.V[instr.X] = state.V[instr.X] | state.V[instr.Y];
+}
 
-    if constexpr (debug) {
-      instruction = fmt::format("5XNN: SE {0:#x}, {1:#x}", Vx, Vy);
-    }
-    break;
-  }
-  // OPCODE 9XNN : Skip the following instruction if the value
-  // of register VX is not equal to the value of register VY
-  case (0x9000): {
-    const auto [Vx, Vy] = get_XY_nibbles(opcode);
-    if (V[Vx] != V[Vy]) {
-      prog_counter = static_cast<uint16_t>(prog_counter + 2) & 0x0FFF;
-    }
+// OPCODE 8XY2 : Set VX to VX AND VY
+void chip8::op_8XY2(const decoded_opcode &instr) {
+  state.V[instr.X] = state.V[instr.X] & state.V[instr.Y];
+}
 
-    if constexpr (debug) {
-      instruction = fmt::format("9XNN: SNE {0:#x}, {1:#x}", Vx, Vy);
-    }
-    break;
+// OPCODE 8XY3 : Set VX to VX XOR VY
+void chip8::op_8XY3(const decoded_opcode &instr) {
+  state.V[instr.X] = state.V[instr.X] ^ state.V[instr.Y];
+}
+
+// OPCODE 8XY4 : Add the value of register VY to register VX
+// Set VF to 01 if a carry occurs else to 0
+void chip8::op_8XY4(const decoded_opcode &instr) {
+  const auto sum = static_cast<uint16_t>(state.V[instr.Y] + state.V[instr.X]);
+  // mask the sum with 0b100000000 (0x100) to get the overflow bit
+  state.V[0xF] = static_cast<uint8_t>((sum & 0x100) >> 8);
+  state.V[instr.X] = static_cast<uint8_t>(sum);
+}
+
+// OPCODE 8XY5 : Subtract the value of register VY from register VX
+// Set VF to 01 if a borrow does not occur, else to 0
+void chip8::op_8XY5(const decoded_opcode &instr) {
+  if (state.V[instr.X] > state.V[instr.Y]) {
+    state.V[0xF] = 1;
+  } else {
+    state.V[0xF] = 0;
   }
-  case (0xF000): {
-    // OPCODE FX15:	Set the delay timer to the value of register VX
-    if (last_two_nibbles(opcode) == 0x15) {
-      const auto Vx = static_cast<uint8_t>(second_nibble(opcode) >> 8);
-      delay_timer = V[Vx];
+  state.V[instr.X] = static_cast<uint8_t>(state.V[instr.X] - state.V[instr.Y]);
+}
 
-      if constexpr (debug) {
-        instruction = fmt::format("FX15: LD {0:#x}, {1:#x}", delay_timer, Vx);
-      }
-    }
-    // OPCODE FX07: Store the current value of the delay timer in register VX
-    else if (last_two_nibbles(opcode) == 0x07) {
-      const auto Vx = static_cast<uint8_t>(second_nibble(opcode) >> 8);
-      V[Vx] = delay_timer;
+// OPCODE 8XY6 : Store the value of register VY
+// shifted right one bit in register VX
+// Set register VF to the least significant
+// bit prior to the shift
+// Vy is first changed and then it is stored in Vx
+void chip8::op_8XY6(const decoded_opcode &instr) {
+  state.V[0xF] = state.V[instr.Y] & 0x01;
+  state.V[instr.Y] = static_cast<uint8_t>(state.V[instr.Y] >> 1);
+  state.V[instr.X] = state.V[instr.Y];
+}
 
-      if constexpr (debug) {
-        instruction = fmt::format("FX07: LD {0:#x}, {1:#x}", Vx, delay_timer);
-      }
-    }
-    // OPCODE FX18: Set the sound timer to the value of register VX
-    else if (last_two_nibbles(opcode) == 0x18) {
-      const auto Vx = static_cast<uint8_t>(second_nibble(opcode) >> 8);
-      sound_timer = V[Vx];
+// OPCODE 8XY7 : Set register VX to the value of VY minus VX
+// Set VF to 01 if a borrow does not occur, else to 0
+void chip8::op_8XY7(const decoded_opcode &instr) {
+  if (state.V[instr.Y] > state.V[instr.X]) {
+    state.V[0xF] = 1;
+  } else {
+    state.V[0xF] = 0;
+  }
+  state.V[instr.X] = static_cast<uint8_t>(state.V[instr.Y] - state.V[instr.X]);
+}
 
-      if constexpr (debug) {
-        instruction = fmt::format("FX18: LD {0:#x}, {1:#x}", sound_timer, Vx);
-      }
-    }
-    // OPCODE FX29: Set I to the memory address of the sprite data
-    // corresponding to the hexadecimal digit stored in register VX
-    else if (last_two_nibbles(opcode) == 0x29) {
-      const auto Vx = static_cast<uint8_t>(second_nibble(opcode) >> 8);
-      I = static_cast<uint16_t>(5 * V[Vx]);
-
-      if constexpr (debug) {
-        instruction = fmt::format("FX29: LD {0:#x}, {1:#x}", I, Vx);
-      }
-    }
-    // OPCODE FX33: Store the binary-coded decimal equivalent of
-    // the value stored in register VX at addresses I, I+1, and I+2
-    else if (last_two_nibbles(opcode) == 0x33) {
-      const auto Vx = static_cast<uint8_t>((second_nibble(opcode) >> 8));
-      const auto [MSB, MidB, LSB] = parse_BCD(V[Vx]);
-      memory[I] = MSB;
-      memory[I + 1] = MidB;
-      memory[I + 2] = LSB;
-
-      if constexpr (debug) {
-        instruction = fmt::format("FX33: LD {0:#x}, {1:#x}", V[Vx], Vx);
-      }
-    }
-    // OPCODE FX55: Store the values of registers V0 to VX
-    // inclusive in memory starting at address I
-    // I is set to I + X + 1 after operation
-    else if (last_two_nibbles(opcode) == 0x55) {
-      const auto Vx = static_cast<uint8_t>((second_nibble(opcode) >> 8));
-      std::copy_n(V.begin(), (Vx + 1), (memory.begin() + I));
-      I = static_cast<uint16_t>(I + Vx + 1);
-
-      if constexpr (debug) {
-        instruction = fmt::format("FX55: LD [{0:#x}], {1:#x}", I, Vx);
-      }
-    }
-    // OPCODE FX65: Fill registers V0 to VX
-    // inclusive with the values stored in memory starting at address I
-    // I is set to I + X + 1 after operation
-    else if (last_two_nibbles(opcode) == 0x65) {
-      const auto Vx = static_cast<uint8_t>((second_nibble(opcode) >> 8));
-      for (size_t i = 0; i <= Vx; i++) {
-        V[i] = memory[I + i];
-      }
-      I = static_cast<uint16_t>(I + Vx + 1);
+// OPCODE 8XYE : Store the value of register VY
+//  shifted left one bit in register VX
+// Set register VF to the most significant
+// bit prior to the shift
+// Vy is first changed and then it is stored in Vx
+void chip8::op_8XYE(const decoded_opcode &instr) {
+  state.V[0xF] = static_cast<uint8_t>((state.V[instr.Y] & 0x80) >> 7);
+  state.V[instr.Y] = static_cast<uint8_t>(state.V[instr.Y] << 1);
+  state.V[instr.X] = state.V[instr.Y];
+}
 
-      if constexpr (debug) {
-        instruction = fmt::format("FX65: LD  {0:#x}, [{1:#x}]", Vx, I);
-      }
-    }
-    // OPCODE FX0A: Wait for a keypress and store the result in register VX
-    else if (last_two_nibbles(opcode) == 0x0A) {
-      const auto Vx = static_cast<uint8_t>((second_nibble(opcode) >> 8));
-      auto [isKeyPressed, index] = numpad->whichKeyIndexIfPressed();
-      if (isKeyPressed) {
-        V[Vx] = index;
-      } else {
-        // reset the counter to repeat this opcode until key is pressed
-        prog_counter = static_cast<uint16_t>(prog_counter - 2);
-      }
+// OPCODE 9XY0 : Skip the following instruction if the value
+// of register VX is not equal to the value of register VY
+void chip8::op_9XY0(const decoded_opcode &instr) {
+  if (state.V[instr.X] != state.V[instr.Y]) {
+    state.prog_counter = static_cast<uint16_t>(state.prog_counter + 2) & 0x0FFF;
+  }
+}
 
-      if constexpr (debug) {
-        instruction = fmt::format("FX0A: LDK {0:#x}, {1:#x}", Vx, V[Vx]);
-      }
-    }
-    // OPCODE FX1E: Add the value stored in register VX to register I
-    else if (last_two_nibbles(opcode) == 0x1E) {
-      const auto Vx = static_cast<uint8_t>(second_nibble(opcode) >> 8);
-      I = static_cast<uint16_t>(I + V[Vx]);
+// OPCODE ANNN: Store memory address NNN in register I
+void chip8::op_ANNN(const decoded_opcode &instr) {
+  state.I = instr.NNN;
+}
 
-      if constexpr (debug) {
-        instruction = fmt::format("FX1E: ADD {0:#x}, {1:#x}", I, Vx);
-      }
-    } else {
-      fmt::print("Unrecognized opcode: {0:#x} \n", opcode);
+// OPCODE BNNN : Jump to address NNN + V0
+void chip8::op_BNNN(const decoded_opcode &instr) {
+  state.prog_counter = static_cast<uint16_t>(instr.NNN + state.V[0]) & 0x0FFF;
+}
+
+// OPCODE CXNN : Set VX to a random number with a mask of NN
+void chip8::op_CXNN(const decoded_opcode &instr) {
+  // xorshift32, the top byte is the best mixed one
+  auto x = state.rng;
+  x ^= x << 13U;
+  x ^= x >> 17U;
+  x ^= x << 5U;
+  state.rng = x;
+  state.V[instr.X] = static_cast<uint8_t>((x >> 24U) & instr.NN);
+}
+
+// OPCODE DXYN: Draw a sprite at position VX, VY with N bytes
+// of sprite data starting at the address stored in I
+// Set VF to 01 if any set pixels are changed to unset, and 00 otherwise
+// The start position wraps around the screen, the sprite itself is
+// clipped at the right and bottom edges
+void chip8::op_DXYN(const decoded_opcode &instr) {
+  const auto x = static_cast<std::size_t>(state.V[instr.X] % display_x);
+  const auto y = static_cast<std::size_t>(state.V[instr.Y] % display_y);
+  const auto rows = std::min<std::size_t>(instr.N, display_y - y);
+
+  uint64_t collision = 0;
+  for (std::size_t row = 0; row < rows; ++row) {
+    const uint8_t sprite = state.memory[(state.I + row) & 0xFFFU];
+    // Bits shifted past the LSB fall off the right edge
+    const uint64_t bits = (static_cast<uint64_t>(sprite) << 56U) >> x;
+    auto &line = state.display[y + row];
+    collision |= line & bits;
+    line ^= bits;
+    if (bits != 0) {
+      dirty_rows |= 1U << (y + row);
     }
-    break;
   }
-  // OPCODE ANNN: Store memory address NNN in register I
-  case (0xA000): {
-    I = last_three_nibbles(opcode);
+  state.V[0xF] = (collision != 0) ? 1 : 0;
+  isDisplaySet = true;
+  if constexpr (profiling) {
+    profile->sprite_pixels += rows * std::min<std::size_t>(8, display_x - x);
+  }
+}
 
-    if constexpr (debug) {
-      instruction = fmt::format("ANNN: LD I, {0:#x}", I);
-    }
-    break;
-  }
-  // OPCODE DXYN: Draw a sprite at position VX, VY with N bytes
-  // of sprite data starting at the address stored in I
-  // Set VF to 01 if any set pixels are changed to unset, and 00 otherwise
-  // TODO: Too many cast required. Check why
-  case (0xD000): {
-    const auto [Vx, Vy] = get_XY_nibbles(opcode);
-    const auto N = last_nibble(opcode);
-
-    for (uint16_t y = 0; y < N; y++) {
-      auto pos = static_cast<uint16_t>(V[Vx] + (display_x * (y + V[Vy])));
-      pos = (pos > display_size) ? display_size : pos;
-      uint8_t sprite = memory.at(static_cast<uint16_t>(I + y));
-
-      for (uint16_t x = 0; x < 8; x++) {
-        auto actual_pos = static_cast<uint16_t>(pos + x);
-        if ((sprite & (0x80 >> x))) {
-          V[0xF] = 0;
-          if (!(display[actual_pos] ^ (1))) {
-            V[0xF] = 1;
-          }
-          display[actual_pos] = static_cast<uint8_t>(display[actual_pos] ^ (1));
-        }
-      }
-    }
-    isDisplaySet = true;
+// OPCODE EX9E:	Skip the following instruction if the key
+// corresponding to the hex value currently stored in register VX is pressed
+void chip8::op_EX9E(const decoded_opcode &instr) {
+  if (is_key_pressed(state.V[instr.X])) {
+    state.prog_counter = static_cast<uint16_t>(state.prog_counter + 2);
+  }
+}
 
-    if constexpr (debug) {
-      instruction = fmt::format("DXYN: DRW {0:#x}, {1:#x}, {2:#x}", Vx, Vy, N);
-    }
-    break;
-  }
-  case (0xE000): {
-    // OPCODE EX9E:	Skip the following instruction if the key
-    // corresponding to the hex value currently stored in register VX is pressed
-    if (last_two_nibbles(opcode) == 0x9E) {
-      const auto Vx = static_cast<uint8_t>(second_nibble(opcode) >> 8);
-      if (numpad->isKeyVxPressed(V[Vx])) {
-        prog_counter = static_cast<uint16_t>(prog_counter + 2);
-      }
+// OPCODE EXA1: Skip the following instruction if the key corresponding
+// to the hex value currently stored in register VX is not pressed
+void chip8::op_EXA1(const decoded_opcode &instr) {
+  if (!is_key_pressed(state.V[instr.X])) {
+    state.prog_counter = static_cast<uint16_t>(state.prog_counter + 2);
+  }
+}
 
-      if constexpr (debug) {
-        instruction = fmt::format("EX9E: SKP {0:#x}", Vx);
-      }
-    }
-    // OPCODE EXA1: Skip the following instruction if the key corresponding
-    // to the hex value currently stored in register VX is not pressed
-    else if (last_two_nibbles(opcode) == 0xA1) {
-      const auto Vx = static_cast<uint8_t>(second_nibble(opcode) >> 8);
-      if (!numpad->isKeyVxPressed(V[Vx])) {
-        prog_counter = static_cast<uint16_t>(prog_counter + 2);
-      }
+// OPCODE FX07: Store the current value of the delay timer in register VX
+void chip8::op_FX07(const decoded_opcode &instr) {
+  state.V[instr.X] = state.delay_timer;
+}
 
-      if constexpr (debug) {
-        instruction = fmt::format("EXA1: SKNP {0:#x}", Vx);
-      }
-    } else {
-      fmt::print("Unrecognized opcode: {0:#x} \n", opcode);
-    }
-    break;
+// OPCODE FX0A: Wait for a keypress and store the result in register VX
+// With several keys held the lowest one wins
+void chip8::op_FX0A(const decoded_opcode &instr) {
+  auto [isKeyPressed, index] = first_pressed_key();
+  if (isKeyPressed) {
+    state.V[instr.X] = index;
+  } else {
+    // reset the counter to repeat this opcode until key is pressed
+    state.prog_counter = static_cast<uint16_t>(state.prog_counter - 2);
+  }
+}
+
+// OPCODE FX15:	Set the delay timer to the value of register VX
+void chip8::op_FX15(const decoded_opcode &instr) {
+  state.delay_timer = state.V[instr.X];
+}
+
+// OPCODE FX18: Set the sound timer to the value of register VX
+void chip8::op_FX18(const decoded_opcode &instr) {
+  state.sound_timer = state.V[instr.X];
+}
+
+// OPCODE FX1E: Add the value stored in register VX to register I
+void chip8::op_FX1E(const decoded_opcode &instr) {
+  state.I = static_cast<uint16_t>(state.I + state.V[instr.X]);
+}
+
+// OPCODE FX29: Set I to the memory address of the sprite data
+// corresponding to the hexadecimal digit stored in register VX
+void chip8::op_FX29(const decoded_opcode &instr) {
+  state.I = static_cast<uint16_t>(5 * state.V[instr.X]);
+}
+
+// OPCODE FX33: Store the binary-coded decimal equivalent of
+// the value stored in register VX at addresses I, I+1, and I+2
+void chip8::op_FX33(const decoded_opcode &instr) {
+  const auto [MSB, MidB, LSB] = parse_BCD(state.V[instr.X]);
+  state.memory[state.I & 0xFFFU] = MSB;
+  state.memory[(state.I + 1U) & 0xFFFU] = MidB;
+  state.memory[(state.I + 2U) & 0xFFFU] = LSB;
+  invalidate_decoded(state.I, 3);
+}
+
+// OPCODE FX55: Store the values of registers V0 to VX
+// inclusive in memory starting at address I, wrapping at 0xFFF
+// I is set to I + X + 1 after operation
+void chip8::op_FX55(const decoded_opcode &instr) {
+  for (std::size_t i = 0; i <= instr.X; i++) {
+    state.memory[(state.I + i) & 0xFFFU] = state.V[i];
   }
+  invalidate_decoded(state.I, instr.X + 1U);
+  state.I = static_cast<uint16_t>(state.I + instr.X + 1);
+}
+
+// OPCODE FX65: Fill registers V0 to VX
+// inclusive with the values stored in memory starting at address I,
+// wrapping at 0xFFF
+// I is set to I + X + 1 after operation
+void chip8::op_FX65(const decoded_opcode &instr) {
+  for (size_t i = 0; i <= instr.X; i++) {
+    state.V[i] = state.memory[(state.I + i) & 0xFFFU];
   }
-  // reset Key events
-  numpad->clearKeyInput();
+  state.I = static_cast<uint16_t>(state.I + instr.X + 1);
+}
+
+void chip8::op_unknown(const decoded_opcode & /*instr*/) {
+  // The decoded form does not keep the raw bits, so read the opcode back
+  // from memory. The program counter has already moved past it
+  const auto opcode = read_opcode(state.prog_counter - 2U);
+  std::fprintf(stderr, "Unrecognized opcode: %#x \n", opcode);
 }
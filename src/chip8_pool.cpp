@@ -0,0 +1,118 @@
+#include "chip8_pool.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+chip8_pool::chip8_pool(const std::size_t instances, const backend selected,
+                       std::size_t workers) {
+  if (instances == 0) {
+    throw std::invalid_argument("A pool needs at least one instance");
+  }
+  if (workers == 0) {
+    workers = std::max(1U, std::thread::hardware_concurrency());
+  }
+  workers = std::min(workers, instances);
+  slots.reserve(instances);
+  for (std::size_t i = 0; i < instances; ++i) {
+    slots.emplace_back(selected);
+  }
+  ranges = std::make_unique<work_range[]>(workers);
+  threads.reserve(workers);
+  try {
+    for (std::size_t worker = 0; worker < workers; ++worker) {
+      threads.emplace_back(&chip8_pool::work, this, worker);
+    }
+  } catch (...) {
+    // The destructor does not run for a half built pool, and joinable
+    // threads would terminate the program
+    stop_workers();
+    throw;
+  }
+}
+
+chip8_pool::~chip8_pool() { stop_workers(); }
+
+void chip8_pool::stop_workers() {
+  {
+    const std::lock_guard<std::mutex> guard{lock};
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+std::size_t chip8_pool::size() const { return slots.size(); }
+
+std::size_t chip8_pool::worker_count() const { return threads.size(); }
+
+chip8 &chip8_pool::instance(const std::size_t index) {
+  return slots.at(index).machine;
+}
+
+const pool_result &chip8_pool::result(const std::size_t index) const {
+  return slots.at(index).result;
+}
+
+void chip8_pool::run_frames(const std::size_t frames) {
+  const auto workers = threads.size();
+  for (std::size_t frame = 0; frame < frames; ++frame) {
+    // Contiguous shares, so each worker mostly walks neighbouring slots
+    for (std::size_t worker = 0; worker < workers; ++worker) {
+      ranges[worker].next.store(slots.size() * worker / workers,
+                                std::memory_order_relaxed);
+      ranges[worker].end = slots.size() * (worker + 1) / workers;
+    }
+    std::unique_lock<std::mutex> guard{lock};
+    busy = workers;
+    ++generation;
+    wake.notify_all();
+    done.wait(guard, [this] { return busy == 0; });
+  }
+}
+
+void chip8_pool::work(const std::size_t worker) {
+  uint64_t seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> guard{lock};
+      wake.wait(guard, [&] { return stopping || generation != seen; });
+      if (stopping) {
+        return;
+      }
+      seen = generation;
+    }
+    run_slice(worker);
+    {
+      const std::lock_guard<std::mutex> guard{lock};
+      --busy;
+    }
+    done.notify_one();
+  }
+}
+
+void chip8_pool::run_slice(const std::size_t worker) {
+  const auto workers = threads.size();
+  // Own share first, then the others in turn
+  for (std::size_t offset = 0; offset < workers; ++offset) {
+    auto &range = ranges[(worker + offset) % workers];
+    while (true) {
+      const auto index = range.next.fetch_add(1, std::memory_order_relaxed);
+      if (index >= range.end) {
+        break;
+      }
+      step(index);
+    }
+  }
+}
+
+void chip8_pool::step(const std::size_t index) {
+  auto &current = slots[index];
+  if (current.machine.get_fault() != fault::none) {
+    return;
+  }
+  current.machine.run_frame();
+  ++current.result.frames;
+  current.result.error = current.machine.get_fault();
+}
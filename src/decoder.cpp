@@ -0,0 +1,14 @@
+#include "decoder.hpp"
+
+static constexpr std::array<decoded_opcode, 0x10000> make_decode_table() {
+  std::array<decoded_opcode, 0x10000> table{};
+  for (std::size_t opcode = 0; opcode < table.size(); ++opcode) {
+    table[opcode] = decode(static_cast<uint16_t>(opcode));
+  }
+  return table;
+}
+
+// constexpr forces the table to be built by the compiler, so there is
+// no start-up cost and the table lives in read-only memory
+constexpr std::array<decoded_opcode, 0x10000> decode_table =
+    make_decode_table();
@@ -0,0 +1,118 @@
+#include "disassembler.hpp"
+#include "chip8.hpp"
+#include "decoder.hpp"
+
+#include "fmt/format.h"
+
+// Formats straight into the caller's buffer, keeping one byte for '\0'
+template <typename... Args>
+static std::size_t write(char *buffer, const std::size_t size,
+                         const char *format, const Args &... args) {
+  if (size == 0) {
+    return 0;
+  }
+  const auto result = fmt::format_to_n(buffer, size - 1, format, args...);
+  const auto length = std::min(result.size, size - 1);
+  buffer[length] = '\0';
+  return length;
+}
+
+std::size_t disassemble(const uint16_t opcode, char *buffer,
+                        const std::size_t size) {
+  const auto &instr = lookup(opcode);
+  switch (instr.id) {
+  case opcode_id::OP_00E0:
+    return write(buffer, size, "00E0: CLS");
+  case opcode_id::OP_00EE:
+    return write(buffer, size, "00EE: RET");
+  case opcode_id::OP_1NNN:
+    return write(buffer, size, "1NNN: JMP {0:#x}", instr.NNN);
+  case opcode_id::OP_2NNN:
+    return write(buffer, size, "2NNN: CALL {0:#x}", instr.NNN);
+  case opcode_id::OP_3XNN:
+    return write(buffer, size, "3XNN: SE {0:#x}, {1:#x}", instr.X, instr.NN);
+  case opcode_id::OP_4XNN:
+    return write(buffer, size, "4XNN: SNE {0:#x}, {1:#x}", instr.X, instr.NN);
+  case opcode_id::OP_5XY0:
+    return write(buffer, size, "5XNN: SE {0:#x}, {1:#x}", instr.X, instr.Y);
+  case opcode_id::OP_6XNN:
+    return write(buffer, size, "6XNN: LD {0:#x}, {1:#x}", instr.X, instr.NN);
+  case opcode_id::OP_7XNN:
+    return write(buffer, size, "7XNN: ADD {0:#x}, {1:#x}", instr.X, instr.NN);
+  case opcode_id::OP_8XY0:
+    return write(buffer, size, "8XY0: LD {0:#x}, {1:#x}", instr.X, instr.Y);
+  case opcode_id::OP_8XY1:
+    return write(buffer, size, "8XY1: OR {0:#x}, {1:#x}", instr.X, instr.Y);
+  case opcode_id::OP_8XY2:
+    return write(buffer, size, "8XY2: AND {0:#x}, {1:#x}", instr.X, instr.Y);
+  case opcode_id::OP_8XY3:
+    return write(buffer, size, "8XY3: XOR {0:#x}, {1:#x}", instr.X, instr.Y);
+  case opcode_id::OP_8XY4:
+    return write(buffer, size, "8XY4: ADD {0:#x}, {1:#x}", instr.X, instr.Y);
+  case opcode_id::OP_8XY5:
+    return write(buffer, size, "8XY5: SUB {0:#x}, {1:#x}", instr.X, instr.Y);
+  case opcode_id::OP_8XY6:
+    return write(buffer, size, "8XY6: SHR {0:#x}, {{,{1:#x}}}", instr.X,
+                 instr.Y);
+  case opcode_id::OP_8XY7:
+    return write(buffer, size, "8XY7: SUBN {0:#x}, {1:#x}", instr.X, instr.Y);
+  case opcode_id::OP_8XYE:
+    return write(buffer, size, "8XYE: SHL {0:#x}, {{,{1:#x}}}", instr.X,
+                 instr.Y);
+  case opcode_id::OP_9XY0:
+    return write(buffer, size, "9XNN: SNE {0:#x}, {1:#x}", instr.X, instr.Y);
+  case opcode_id::OP_ANNN:
+    return write(buffer, size, "ANNN: LD I, {0:#x}", instr.NNN);
+  case opcode_id::OP_BNNN:
+    return write(buffer, size, "BNNN: JMP V0, {0:#x}", instr.NNN);
+  case opcode_id::OP_CXNN:
+    return write(buffer, size, "CXNN: RND {0:#x}, {1:#x}", instr.X, instr.NN);
+  case opcode_id::OP_DXYN:
+    return write(buffer, size, "DXYN: DRW {0:#x}, {1:#x}, {2:#x}", instr.X,
+                 instr.Y, instr.N);
+  case opcode_id::OP_EX9E:
+    return write(buffer, size, "EX9E: SKP {0:#x}", instr.X);
+  case opcode_id::OP_EXA1:
+    return write(buffer, size, "EXA1: SKNP {0:#x}", instr.X);
+  case opcode_id::OP_FX07:
+    return write(buffer, size, "FX07: LD {0:#x}, DT", instr.X);
+  case opcode_id::OP_FX0A:
+    return write(buffer, size, "FX0A: LDK {0:#x}", instr.X);
+  case opcode_id::OP_FX15:
+    return write(buffer, size, "FX15: LD DT, {0:#x}", instr.X);
+  case opcode_id::OP_FX18:
+    return write(buffer, size, "FX18: LD ST, {0:#x}", instr.X);
+  case opcode_id::OP_FX1E:
+    return write(buffer, size, "FX1E: ADD I, {0:#x}", instr.X);
+  case opcode_id::OP_FX29:
+    return write(buffer, size, "FX29: LD F, {0:#x}", instr.X);
+  case opcode_id::OP_FX33:
+    return write(buffer, size, "FX33: LD B, {0:#x}", instr.X);
+  case opcode_id::OP_FX55:
+    return write(buffer, size, "FX55: LD [I], {0:#x}", instr.X);
+  case opcode_id::OP_FX65:
+    return write(buffer, size, "FX65: LD {0:#x}, [I]", instr.X);
+  case opcode_id::UNKNOWN:
+    break;
+  }
+  return write(buffer, size, "Unrecognized opcode: {0:#x}", opcode);
+}
+
+std::size_t disassemble(const uint16_t prog_counter, const uint16_t opcode,
+                        char *buffer, const std::size_t size) {
+  const auto prefix = write(buffer, size, "{0:#05x}  ", prog_counter);
+  return prefix + disassemble(opcode, buffer + prefix, size - prefix);
+}
+
+std::string disassemble(const uint16_t opcode) {
+  std::array<char, disassembly_max_length> line{};
+  const auto length = disassemble(opcode, line.data(), line.size());
+  return std::string(line.data(), length);
+}
+
+std::string last_instruction(const chip8 &emulator) {
+  if (emulator.get_trace_size() > 0) {
+    return disassemble(emulator.get_trace(0).opcode);
+  }
+  return "";
+}
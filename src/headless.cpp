@@ -0,0 +1,315 @@
+// Own headers
+#include "chip8.hpp"
+#include "hash.hpp"
+#include "movie.hpp"
+#include "rom_store.hpp"
+
+// System headers
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+// Third-party headers
+#include <argparse/argparse.hpp>
+#include <fmt/format.h>
+
+// From this cycle on, the keys in mask are held (bit n is key n)
+struct key_event {
+  std::size_t cycle;
+  uint16_t mask;
+};
+
+// One "<cycle> <hex mask>" pair per line, lines starting with # are skipped
+static std::vector<key_event> read_key_script(const std::string &file_name) {
+  std::ifstream file(file_name);
+  if (!file.is_open()) {
+    throw std::invalid_argument("Given filename " + file_name +
+                                " does not exist!");
+  }
+  std::vector<key_event> events;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::size_t end = 0;
+    const auto cycle = std::stoul(line, &end);
+    const auto mask = std::stoul(line.substr(end), nullptr, 16);
+    if (mask > 0xFFFF || (!events.empty() && cycle < events.back().cycle)) {
+      throw std::invalid_argument("Bad key script line: " + line);
+    }
+    events.push_back({cycle, static_cast<uint16_t>(mask)});
+  }
+  return events;
+}
+
+// For options the emulator keeps in 32 bits, so a value that does not fit
+// is an error instead of being truncated
+static std::size_t parse_u32(const std::string &value, const int base) {
+  const auto parsed = std::stoul(value, nullptr, base);
+  if (parsed > UINT32_MAX) {
+    throw std::out_of_range(value + " does not fit in 32 bits");
+  }
+  return parsed;
+}
+
+static bool ends_with(const std::string &text, const std::string &suffix) {
+  return text.size() >= suffix.size() &&
+         text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static uint64_t display_hash(const chip8_state &state) {
+  // Byte by byte, most significant first, so the hash does not depend on
+  // the host byte order
+  uint64_t hash = fnv1a_offset;
+  for (const auto row : state.display) {
+    for (int shift = 56; shift >= 0; shift -= 8) {
+      const auto byte = static_cast<uint8_t>(row >> shift);
+      hash = fnv1a(&byte, 1, hash);
+    }
+  }
+  return hash;
+}
+
+static void print_report(const chip8_state &state, std::size_t cycles,
+                         double seconds) {
+  for (std::size_t i = 0; i < state.V.size(); ++i) {
+    fmt::print("V{:X}: {:#04x}{}", i, state.V[i], (i % 8 == 7) ? "\n" : " ");
+  }
+  fmt::print("I: {:#05x} PC: {:#05x} DT: {:#04x} ST: {:#04x} SP: {}\n",
+             state.I, state.prog_counter, state.delay_timer,
+             state.sound_timer, state.stack_pointer);
+  if (state.error != fault::none) {
+    fmt::print("fault: {}\n", state.error == fault::stack_overflow
+                                  ? "stack overflow"
+                                  : "stack underflow");
+  }
+  fmt::print("display hash: {:016x}\n", display_hash(state));
+  fmt::print("cycles: {} in {:.3f} s, {:.0f} instructions/s\n", cycles,
+             seconds, seconds > 0 ? static_cast<double>(cycles) / seconds : 0);
+}
+
+// Runs up to each key event, then applies it. Returns the cycles run
+static std::size_t run_script(chip8 &emulator, std::size_t cycles,
+                              const std::vector<key_event> &events) {
+  std::size_t done = 0;
+  auto next_event = events.begin();
+  while (done < cycles && emulator.get_fault() == fault::none) {
+    while (next_event != events.end() && next_event->cycle <= done) {
+      emulator.set_keys(next_event->mask);
+      ++next_event;
+    }
+    const auto until =
+        (next_event != events.end()) ? std::min(next_event->cycle, cycles)
+                                     : cycles;
+    emulator.run(until - done);
+    done = until;
+  }
+  return done;
+}
+
+// Feeds the recorded keys frame by frame, exactly as the frontend ran it
+static int play_movie(chip8 &emulator, const std::string &file_name) {
+  std::size_t cycles = 0;
+  std::chrono::duration<double> elapsed{0};
+  try {
+    movie_reader movie{file_name};
+    const auto &header = movie.header();
+    if (header.rom_hash != rom_hash(emulator.get_state())) {
+      std::cout << file_name << " was recorded with a different ROM"
+                << std::endl;
+      return 1;
+    }
+    emulator.set_clock_hz(header.clock_hz);
+    emulator.seed_rng(header.seed);
+    const auto start = std::chrono::steady_clock::now();
+    std::size_t frames = 0;
+    uint16_t keys = 0;
+    while (emulator.get_fault() == fault::none && movie.next(keys)) {
+      emulator.set_keys(keys);
+      emulator.run_frame();
+      ++frames;
+    }
+    elapsed = std::chrono::steady_clock::now() - start;
+    cycles = (frames * header.clock_hz + timer_hz - 1) / timer_hz;
+  } catch (std::exception &e) {
+    std::cout << e.what() << std::endl;
+    return 1;
+  }
+  print_report(emulator.get_state(), cycles, elapsed.count());
+  return (emulator.get_fault() == fault::none) ? 0 : 2;
+}
+
+// Every ROM of the archive from power on, one line per ROM. Clocks stored
+// in the archive override the --clock option
+static int run_archive(chip8 &emulator, const std::string &file_name,
+                       std::size_t clock_hz, std::size_t frames,
+                       std::size_t cycles,
+                       const std::vector<key_event> &events) {
+  rom_store store;
+  try {
+    store.add_archive(file_name);
+  } catch (std::exception &e) {
+    std::cout << e.what() << std::endl;
+    return 1;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  std::size_t total = 0;
+  std::size_t faults = 0;
+  for (std::size_t i = 0; i < store.size(); ++i) {
+    const auto &info = store.info(i);
+    const std::size_t rom_clock =
+        (info.clock_hz != 0) ? info.clock_hz : clock_hz;
+    emulator.set_clock_hz(static_cast<uint32_t>(rom_clock));
+    store.load(i, emulator);
+    emulator.reset();
+    const auto done = run_script(
+        emulator,
+        (frames > 0) ? (frames * rom_clock + timer_hz - 1) / timer_hz : cycles,
+        events);
+    total += done;
+    const bool faulted = emulator.get_fault() != fault::none;
+    faults += faulted ? 1 : 0;
+    fmt::print("{} {:016x} {}{}\n", info.name,
+               display_hash(emulator.get_state()), done,
+               faulted ? " fault" : "");
+  }
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  const auto seconds = elapsed.count();
+  fmt::print("{} ROMs ({} distinct), {} faulted\n", store.size(),
+             store.unique_count(), faults);
+  fmt::print("cycles: {} in {:.3f} s, {:.0f} instructions/s\n", total,
+             seconds, seconds > 0 ? static_cast<double>(total) / seconds : 0);
+  return (faults == 0) ? 0 : 2;
+}
+
+int main(int argc, char *argv[]) {
+  // CLI Parser
+  argparse::ArgumentParser program("CHIP8 headless");
+  program.add_argument("ROM").help("Specify the name of the ROM");
+  program.add_argument("--cycles")
+      .help("Number of instructions to execute")
+      .default_value(std::size_t{0})
+      .action([](const std::string &value) { return std::stoul(value); });
+  program.add_argument("--frames")
+      .help("Number of frames to execute, overrides --cycles")
+      .default_value(std::size_t{0})
+      .action([](const std::string &value) { return std::stoul(value); });
+  program.add_argument("--clock")
+      .help("Instructions per second of emulated time")
+      .default_value(std::size_t{default_clock_hz})
+      .action([](const std::string &value) { return parse_u32(value, 10); });
+  program.add_argument("--keys")
+      .help("Key script, one '<cycle> <hex key mask>' per line")
+      .default_value(std::string{});
+  program.add_argument("--seed")
+      .help("Seed of the CXNN random number generator")
+      .default_value(std::size_t{default_rng_seed})
+      .action([](const std::string &value) { return parse_u32(value, 0); });
+  program.add_argument("--replay")
+      .help("Movie to play back, its clock and seed override the options")
+      .default_value(std::string{});
+  program.add_argument("--archive")
+      .help("ROM is an archive made by chip8_pack, run every ROM in it")
+      .default_value(false)
+      .implicit_value(true);
+  program.add_argument("--profile")
+      .help("Write the profiling counters to this file, CSV when it ends "
+            "in .csv and JSON otherwise. Needs an ENABLE_PROFILING build")
+      .default_value(std::string{});
+  program.add_argument("--backend")
+      .help("interpreter or threaded")
+      .default_value(std::string{"interpreter"});
+  // The numeric options throw std::invalid_argument and std::out_of_range
+  // from std::stoul, not just argparse's std::runtime_error
+  try {
+    program.parse_args(argc, argv);
+  } catch (const std::exception &err) {
+    std::cout << err.what() << std::endl;
+    std::cout << program;
+    exit(1);
+  }
+
+  const auto clock_hz = program.get<std::size_t>("--clock");
+  const auto frames = program.get<std::size_t>("--frames");
+  // Same count as calling run_frame() once per frame from power on
+  const auto cycles = (frames > 0)
+                          ? (frames * clock_hz + timer_hz - 1) / timer_hz
+                          : program.get<std::size_t>("--cycles");
+  const auto replay = program.get<std::string>("--replay");
+  const auto archive = program.get<bool>("--archive");
+  if (archive && !replay.empty()) {
+    std::cout << "--replay needs a single ROM, not an --archive" << std::endl;
+    exit(1);
+  }
+  const auto profile_file = program.get<std::string>("--profile");
+  if (!profile_file.empty() && !profiling) {
+    std::cout << "--profile needs a build with ENABLE_PROFILING" << std::endl;
+    exit(1);
+  }
+  if (cycles == 0 && replay.empty()) {
+    std::cout << "Nothing to run, give --cycles or --frames" << std::endl;
+    std::cout << program;
+    exit(1);
+  }
+  const auto backend_name = program.get<std::string>("--backend");
+  if (backend_name != "interpreter" && backend_name != "threaded") {
+    std::cout << "Unknown backend " << backend_name
+              << ", give interpreter or threaded" << std::endl;
+    exit(1);
+  }
+  const auto engine = (backend_name == "threaded") ? backend::threaded
+                                                   : backend::interpreter;
+
+  // Emulator setup and load rom
+  chip8 emulator{engine};
+  std::vector<key_event> events;
+  try {
+    emulator.set_clock_hz(static_cast<uint32_t>(clock_hz));
+    const auto seed = program.get<std::size_t>("--seed");
+    emulator.seed_rng(static_cast<uint32_t>(seed));
+    if (!archive) {
+      emulator.load_memory(program.get<std::string>("ROM"));
+    }
+    const auto script = program.get<std::string>("--keys");
+    if (!script.empty()) {
+      events = read_key_script(script);
+    }
+  } catch (std::exception &e) {
+    std::cout << e.what() << std::endl;
+    exit(1);
+  }
+
+  int status = 0;
+  if (!replay.empty()) {
+    status = play_movie(emulator, replay);
+  } else if (archive) {
+    status = run_archive(emulator, program.get<std::string>("ROM"), clock_hz,
+                         frames, cycles, events);
+  } else {
+    const auto start = std::chrono::steady_clock::now();
+    const auto done = run_script(emulator, cycles, events);
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    print_report(emulator.get_state(), done, elapsed.count());
+    status = (emulator.get_fault() == fault::none) ? 0 : 2;
+  }
+
+  // Status 1 means nothing ran
+  if (!profile_file.empty() && status != 1) {
+    std::ofstream out(profile_file);
+    if (!out.is_open()) {
+      std::cout << "Could not create " << profile_file << std::endl;
+      return 1;
+    }
+    if (ends_with(profile_file, ".csv")) {
+      write_profile_csv(out, emulator.get_profile());
+    } else {
+      write_profile_json(out, emulator.get_profile());
+    }
+  }
+  return status;
+}
@@ -1,9 +1,19 @@
 // Own headers
 #include "chip8.hpp"
 #include "imgui_helper.hpp"
+#include "movie.hpp"
+#include "rewind_buffer.hpp"
+#include "sfml_keyboard.hpp"
+#include "triple_buffer.hpp"
 
 // System headers
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <random>
+#include <thread>
 #include <vector>
 
 // Third-party headers
@@ -11,7 +21,6 @@
 #include <SFML/System/Clock.hpp>
 #include <SFML/Window/Event.hpp>
 #include <argparse/argparse.hpp>
-#include <boost/circular_buffer.hpp>
 #include <fmt/format.h>
 #include <imgui-SFML.h>
 #include <imgui.h>
@@ -20,14 +29,112 @@
 static const sf::Color bgPixel{0, 0, 0, 255}; // Background pixels are black
 static const sf::Color spritePixel{0, 255, 0, 255}; // Sprite pixel is Green
 
-// Local function
-static void drawGfx(const std::array<uint8_t, display_size> &gfx,
-                    sf::Image &window) {
-  for (uint y = 0; y < display_y; ++y) {
+// Turbo mode emulates for this long per rendered frame, so the window
+// still presents at its normal rate while emulation runs uncapped
+static const sf::Time turbo_budget = sf::milliseconds(15);
+static constexpr int turbo_batch = 16; // frames between clock checks
+
+// About five minutes of history at 60 frames per second
+static constexpr std::size_t rewind_bytes = 8U << 20U;
+static constexpr std::size_t rewind_frames = 5 * 60 * 60;
+
+static constexpr std::size_t bytes_per_pixel = 4; // RGBA
+using frame_buffer = std::array<sf::Uint8, display_size * bytes_per_pixel>;
+
+// Local functions
+static void setPixel(frame_buffer &pixels, std::size_t x, std::size_t y,
+                     const sf::Color &color) {
+  auto *out = &pixels.at((x + (display_x * y)) * bytes_per_pixel);
+  out[0] = color.r;
+  out[1] = color.g;
+  out[2] = color.b;
+  out[3] = color.a;
+}
+
+// Converts the band between the first and last dirty rows and uploads
+// only that part of the texture, nothing at all for a clean frame
+static void drawGfx(const chip8_state &state, uint32_t dirty_rows,
+                    frame_buffer &pixels, sf::Texture &texture) {
+  if (dirty_rows == 0) {
+    return;
+  }
+  uint first = 0;
+  while (((dirty_rows >> first) & 1U) == 0) {
+    ++first;
+  }
+  uint last = display_y - 1;
+  while (((dirty_rows >> last) & 1U) == 0) {
+    --last;
+  }
+  for (uint y = first; y <= last; ++y) {
     for (uint x = 0; x < display_x; ++x) {
-      const auto pixel =
-          (gfx.at(x + (display_x * y)) == 1) ? spritePixel : bgPixel;
-      window.setPixel(x, y, pixel);
+      const auto &pixel = is_pixel_set(state, x, y) ? spritePixel : bgPixel;
+      setPixel(pixels, x, y, pixel);
+    }
+  }
+  texture.update(&pixels.at(display_x * first * bytes_per_pixel), display_x,
+                 last - first + 1, 0, first);
+}
+
+static uint32_t changed_rows(const std::array<uint64_t, display_y> &shown,
+                             const chip8_state &state) {
+  uint32_t rows = 0;
+  for (std::size_t y = 0; y < display_y; ++y) {
+    if (shown[y] != state.display[y]) {
+      rows |= 1U << y;
+    }
+  }
+  return rows;
+}
+
+// Everything the render thread and the emulation thread share
+struct emulation_controls {
+  std::atomic<bool> running{true};
+  std::atomic<bool> paused{false};
+  std::atomic<int> steps{0};
+  std::atomic<bool> turbo{false};
+  std::atomic<uint32_t> clock_hz{default_clock_hz};
+  std::atomic<uint16_t> keys{0};
+  triple_buffer<chip8_state> frames;
+};
+
+// Runs on its own thread, paced by emulated time: one 60 Hz frame per
+// 1/60 s, or as fast as possible in turbo. Either way a frame is
+// published at most once per 1/60 s
+static void emulate(chip8 &emulator, emulation_controls &controls) {
+  using clock = std::chrono::steady_clock;
+  constexpr auto frame_period =
+      std::chrono::nanoseconds{std::chrono::seconds{1}} / timer_hz;
+  auto deadline = clock::now() + frame_period;
+  while (controls.running.load(std::memory_order_relaxed)) {
+    emulator.set_keys(controls.keys.load(std::memory_order_relaxed));
+    const auto hz = controls.clock_hz.load(std::memory_order_relaxed);
+    if (hz != emulator.get_clock_hz()) {
+      emulator.set_clock_hz(hz);
+    }
+    bool execute = !controls.paused.load(std::memory_order_relaxed);
+    if (!execute && controls.steps.load(std::memory_order_relaxed) > 0) {
+      controls.steps.fetch_sub(1, std::memory_order_relaxed);
+      execute = true;
+    }
+    if (execute) {
+      emulator.run_frame();
+    }
+
+    if (controls.turbo.load(std::memory_order_relaxed)) {
+      if (clock::now() < deadline) {
+        continue;
+      }
+    } else {
+      std::this_thread::sleep_until(deadline);
+    }
+    controls.frames.write_buffer() = emulator.get_state();
+    controls.frames.publish();
+    // After a long stall start over rather than rushing to catch up
+    deadline += frame_period;
+    const auto now = clock::now();
+    if (deadline < now) {
+      deadline = now + frame_period;
     }
   }
 }
@@ -36,6 +143,16 @@ int main(int argc, char *argv[]) {
   // CLI Parser
   argparse::ArgumentParser program("CHIP8");
   program.add_argument("ROM").help("Specify the name of the ROM");
+  program.add_argument("--threaded")
+      .help("Run the emulation on its own thread")
+      .default_value(false)
+      .implicit_value(true);
+  program.add_argument("--record")
+      .help("Record the keys of every frame to a movie file")
+      .default_value(std::string{});
+  program.add_argument("--replay")
+      .help("Play back a movie made with --record, then continue live")
+      .default_value(std::string{});
   try {
     program.parse_args(argc, argv);
   } catch (const std::runtime_error &err) {
@@ -44,25 +161,85 @@ int main(int argc, char *argv[]) {
     exit(0);
   }
   auto file_name = program.get<std::string>("ROM");
+  const auto threaded = program.get<bool>("--threaded");
+  const auto record_file = program.get<std::string>("--record");
+  const auto replay_file = program.get<std::string>("--replay");
+  if (threaded && !(record_file.empty() && replay_file.empty())) {
+    std::cout << "Movies need every frame on the main thread, they do not "
+                 "work with --threaded"
+              << std::endl;
+    exit(1);
+  }
 
   // Emulator setup and load rom
   chip8 emulator;
+  // Interactive play wants different CXNN numbers on every run, unless a
+  // movie fixes them
+  uint32_t seed = std::random_device{}();
+  auto clock_hz = default_clock_hz;
+  std::unique_ptr<movie_reader> player;
+  std::unique_ptr<movie_writer> recorder;
   try {
     emulator.load_memory(file_name);
     // read_file(rom, file_name);
+    const auto loaded_rom = rom_hash(emulator.get_state());
+    if (!replay_file.empty()) {
+      player = std::make_unique<movie_reader>(replay_file);
+      if (player->header().rom_hash != loaded_rom) {
+        throw std::invalid_argument(replay_file +
+                                    " was recorded with a different ROM");
+      }
+      seed = player->header().seed;
+      clock_hz = player->header().clock_hz;
+    }
+    emulator.seed_rng(seed);
+    emulator.set_clock_hz(clock_hz);
+    if (!record_file.empty()) {
+      movie_header header;
+      header.clock_hz = clock_hz;
+      header.seed = seed;
+      header.rom_hash = loaded_rom;
+      recorder = std::make_unique<movie_writer>(record_file, header);
+    }
   } catch (std::exception &e) {
     std::cout << e.what() << std::endl;
     std::abort();
   }
+  // A movie fixes the clock and forbids rewinding, it has to match the run
+  const bool has_movie = player || recorder;
+
+  // Every emulated frame of the single threaded loop goes through here, so
+  // a movie sees all of them
+  const auto run_frame = [&](const uint16_t live_keys) {
+    auto frame_keys = live_keys;
+    if (player && !player->next(frame_keys)) {
+      std::cout << "Replay finished" << std::endl;
+      player.reset();
+    }
+    if (recorder) {
+      recorder->record(frame_keys);
+    }
+    emulator.set_keys(frame_keys);
+    emulator.run_frame();
+  };
 
   // SFML Graphics
   constexpr int scaleFactor = 4;
   sf::RenderWindow window(sf::VideoMode(640.f, 480.f),
                           "CHIP8 Emulator/Interpretter");
-  boost::circular_buffer<std::string> instr_cb(10);
-  int slider_input = 10;
+  auto slider_input = static_cast<int>(clock_hz);
   bool fall_through = false;
-  sf::Image CHIP8_window;
+  bool turbo = false;
+  bool step_back = false;
+  bool rewinding = false;
+  uint16_t keys = 0;
+  rewind_buffer history{rewind_bytes, rewind_frames};
+  chip8_state previous{};
+  frame_buffer pixels{};
+  // What the texture currently shows, to find the changed rows when only
+  // a copy of the state is available
+  std::array<uint64_t, display_y> shown{0};
+  emulation_controls controls;
   sf::Texture texture;
   sf::Sprite chip8_sprite;
   sf::Clock deltaClock;
@@ -72,7 +249,21 @@ int main(int argc, char *argv[]) {
   chip8_sprite.setScale(scaleFactor, scaleFactor);
   chip8_sprite.setPosition(float(window.getSize().x / 2) - (32 * scaleFactor),
                            float(window.getSize().y / 2) - (16 * scaleFactor));
-  CHIP8_window.create(display_x, display_y, sf::Color::Black);
+  texture.create(display_x, display_y);
+  for (uint y = 0; y < display_y; ++y) {
+    for (uint x = 0; x < display_x; ++x) {
+      setPixel(pixels, x, y, bgPixel);
+    }
+  }
+  texture.update(pixels.data());
+  chip8_sprite.setTexture(texture);
+
+  // From here on only the emulation thread touches the emulator
+  std::thread emulation_thread;
+  if (threaded) {
+    emulation_thread =
+        std::thread{emulate, std::ref(emulator), std::ref(controls)};
+  }
 
   // Main emulator loop
   while (window.isOpen()) {
@@ -84,45 +275,106 @@ int main(int argc, char *argv[]) {
       if (event.type == sf::Event::Closed) {
         window.close();
       }
+      if (event.type == sf::Event::KeyPressed &&
+          event.key.code == sf::Keyboard::Tab) {
+        turbo = !turbo;
+      }
+      if (event.type == sf::Event::KeyPressed ||
+          event.type == sf::Event::KeyReleased) {
+        if (event.key.code == sf::Keyboard::BackSpace) {
+          rewinding = (event.type == sf::Event::KeyPressed);
+        }
+        const auto key = keypad_index(event.key.code);
+        const auto bit = (key >= 0) ? (1U << key) : 0U;
+        if (event.type == sf::Event::KeyPressed) {
+          keys = static_cast<uint16_t>(keys | bit);
+        } else {
+          keys = static_cast<uint16_t>(keys & ~bit);
+        }
+      }
     }
     ImGui::SFML::Update(window, deltaClock.restart());
 
     window.clear();
 
+    // The threaded emulator is only ever seen through its last published
+    // copy of the state
+    const bool new_frame = threaded && controls.frames.update();
+    const chip8_state &view =
+        threaded ? controls.frames.read_buffer() : emulator.get_state();
+
     if constexpr (debug) {
-      using ch8_regs = IMGUI::chip8_registers;
-      IMGUI::draw_registers_window(
-          ch8_regs{emulator.get_V_registers(), emulator.get_stack(),
-                   emulator.get_prog_counter(), emulator.get_I_register()});
+      IMGUI::draw_registers_window(view);
+    }
+    // The threaded emulator counts on its own thread, so only the
+    // single-threaded one can be watched live
+    if constexpr (profiling) {
+      if (!threaded) {
+        IMGUI::draw_profile_window(emulator.get_profile());
+      }
     }
 
-    IMGUI::draw_slider_window(slider_input);
+    IMGUI::draw_slider_window(slider_input, turbo);
 
     if constexpr (debug) {
       // mutates fall_through option based on input
-      shouldExecuteCycle = IMGUI::draw_debugger_options(fall_through);
+      shouldExecuteCycle =
+          IMGUI::draw_debugger_options(fall_through, step_back);
     }
 
-    int cpu_freq = slider_input;
-    while (cpu_freq--) {
-      if (shouldExecuteCycle) {
-        emulator.step_one_cycle();
-        instr_cb.push_front(emulator.get_instruction());
+    if (threaded) {
+      const bool paused = debug && !fall_through;
+      controls.keys.store(keys, std::memory_order_relaxed);
+      controls.clock_hz.store(static_cast<uint32_t>(slider_input),
+                              std::memory_order_relaxed);
+      controls.turbo.store(turbo, std::memory_order_relaxed);
+      controls.paused.store(paused, std::memory_order_relaxed);
+      if (shouldExecuteCycle && paused) {
+        controls.steps.fetch_add(1, std::memory_order_relaxed);
+      }
+      if (new_frame) {
+        drawGfx(view, changed_rows(shown, view), pixels, texture);
+        shown = view.display;
+      }
+    } else {
+      if ((rewinding || step_back) && !has_movie) {
+        // One frame back per rendered frame while Backspace is held
+        if (history.pop(previous)) {
+          emulator.load_state(previous);
+        }
+      } else if (shouldExecuteCycle) {
+        // The state before each frame is kept, so popping it undoes
+        // exactly that frame
+        history.push(emulator.get_state());
+        // One 60 Hz frame of emulated time per rendered frame
+        if (!has_movie) {
+          emulator.set_clock_hz(static_cast<uint32_t>(slider_input));
+        }
+        run_frame(keys);
+        // Only the last of the turbo frames gets drawn, present() keeps
+        // the rows changed by all of them
+        const sf::Clock turbo_clock;
+        while (turbo && turbo_clock.getElapsedTime() < turbo_budget) {
+          for (int frame = 0; frame < turbo_batch; ++frame) {
+            run_frame(keys);
+          }
+        }
       }
-    }
 
-    const auto gfx = emulator.get_display_pixels();
-    drawGfx(gfx, CHIP8_window);
+      drawGfx(emulator.get_state(), emulator.present(), pixels, texture);
 
-    if constexpr (debug) {
-      IMGUI::draw_instruction_window(instr_cb);
+      if constexpr (debug) {
+        IMGUI::draw_instruction_window(emulator);
+      }
     }
 
-    texture.loadFromImage(CHIP8_window);
-    chip8_sprite.setTexture(texture);
     window.draw(chip8_sprite);
     ImGui::SFML::Render(window);
     window.display();
   }
+  controls.running.store(false, std::memory_order_relaxed);
+  if (emulation_thread.joinable()) {
+    emulation_thread.join();
+  }
   ImGui::SFML::Shutdown();
 }
\ No newline at end of file
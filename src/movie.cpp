@@ -0,0 +1,92 @@
+#include "movie.hpp"
+#include "hash.hpp"
+
+#include <limits>
+#include <stdexcept>
+
+uint64_t rom_hash(const chip8_state &state) {
+  return fnv1a(state.memory.data(), state.memory.size());
+}
+
+movie_writer::movie_writer(const std::string &file_name,
+                           const movie_header &header)
+    : file(file_name, std::ios::binary | std::ios::trunc) {
+  if (!file.is_open()) {
+    throw std::invalid_argument("Could not create movie " + file_name);
+  }
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+}
+
+movie_writer::~movie_writer() {
+  // Errors cannot be reported from here, call flush() to see them
+  end_run();
+  file.write(reinterpret_cast<const char *>(chunk.data()),
+             static_cast<std::streamsize>(chunk_used * sizeof(run)));
+}
+
+void movie_writer::record(const uint16_t keys) {
+  if (current.frames > 0 && current.keys == keys &&
+      current.frames < std::numeric_limits<uint16_t>::max()) {
+    ++current.frames;
+    return;
+  }
+  end_run();
+  current = {keys, 1};
+}
+
+void movie_writer::end_run() {
+  if (current.frames == 0) {
+    return;
+  }
+  chunk[chunk_used++] = current;
+  current.frames = 0;
+  if (chunk_used == chunk.size()) {
+    file.write(reinterpret_cast<const char *>(chunk.data()), sizeof(chunk));
+    chunk_used = 0;
+  }
+}
+
+void movie_writer::flush() {
+  // The open run is closed early, the next frame simply starts a new one
+  end_run();
+  file.write(reinterpret_cast<const char *>(chunk.data()),
+             static_cast<std::streamsize>(chunk_used * sizeof(run)));
+  chunk_used = 0;
+  file.flush();
+  if (!file) {
+    throw std::runtime_error("Could not write the movie");
+  }
+}
+
+movie_reader::movie_reader(const std::string &file_name)
+    : file(file_name, std::ios::binary) {
+  if (!file.is_open()) {
+    throw std::invalid_argument("Given filename " + file_name +
+                                " does not exist!");
+  }
+  file.read(reinterpret_cast<char *>(&info), sizeof(info));
+  if (!file || info.magic != movie_magic || info.version != movie_version) {
+    throw std::invalid_argument(file_name + " is not a movie");
+  }
+}
+
+const movie_header &movie_reader::header() const { return info; }
+
+bool movie_reader::read_chunk() {
+  file.read(reinterpret_cast<char *>(chunk.data()), sizeof(chunk));
+  chunk_used = static_cast<std::size_t>(file.gcount()) / sizeof(run);
+  chunk_pos = 0;
+  return chunk_used > 0;
+}
+
+bool movie_reader::next(uint16_t &keys) {
+  while (current.frames == 0) {
+    if (chunk_pos == chunk_used && !read_chunk()) {
+      return false;
+    }
+    current = chunk[chunk_pos++];
+  }
+  --current.frames;
+  keys = current.keys;
+  return true;
+}
@@ -0,0 +1,80 @@
+// Own headers
+#include "rom_archive.hpp"
+
+// System headers
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <vector>
+
+// Third-party headers
+#include <argparse/argparse.hpp>
+#include <fmt/format.h>
+
+// One "<path> [clock hz] [quirk profile]" per line, lines starting with #
+// are skipped. ROMs are named after their file
+static std::vector<archive_rom> read_manifest(const std::string &file_name) {
+  std::ifstream file(file_name);
+  if (!file.is_open()) {
+    throw std::invalid_argument("Given filename " + file_name +
+                                " does not exist!");
+  }
+  std::vector<archive_rom> roms;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream fields(line);
+    std::string path;
+    unsigned long clock_hz = 0;
+    unsigned quirks = 0;
+    fields >> path;
+    if (!(fields >> clock_hz)) {
+      clock_hz = 0;
+    } else if (!(fields >> quirks)) {
+      quirks = 0;
+    }
+    if (path.empty() || clock_hz > UINT32_MAX || quirks > UINT8_MAX) {
+      throw std::invalid_argument("Bad manifest line: " + line);
+    }
+    std::ifstream rom(path, std::ios::binary);
+    if (!rom.is_open()) {
+      throw std::invalid_argument("Given filename " + path +
+                                  " does not exist!");
+    }
+    roms.push_back({std::filesystem::path(path).filename().string(),
+                    {std::istreambuf_iterator<char>(rom),
+                     std::istreambuf_iterator<char>()},
+                    static_cast<uint32_t>(clock_hz),
+                    static_cast<uint8_t>(quirks)});
+  }
+  return roms;
+}
+
+int main(int argc, char *argv[]) {
+  // CLI Parser
+  argparse::ArgumentParser program("CHIP8 pack");
+  program.add_argument("MANIFEST")
+      .help("ROMs to pack, one '<path> [clock hz] [quirk profile]' per line");
+  program.add_argument("ARCHIVE").help("Archive to write");
+  try {
+    program.parse_args(argc, argv);
+  } catch (const std::runtime_error &err) {
+    std::cout << err.what() << std::endl;
+    std::cout << program;
+    exit(0);
+  }
+
+  try {
+    const auto roms = read_manifest(program.get<std::string>("MANIFEST"));
+    write_archive(program.get<std::string>("ARCHIVE"), roms);
+    fmt::print("packed {} ROMs\n", roms.size());
+  } catch (std::exception &e) {
+    std::cout << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,59 @@
+#include "profile.hpp"
+
+// Lower end of a frame_instructions bucket
+static uint64_t bucket_floor(const std::size_t bucket) {
+  return (bucket == 0) ? 0 : uint64_t{1} << (bucket - 1);
+}
+
+void write_profile_json(std::ostream &out, const chip8_profile &profile) {
+  out << "{\n  \"opcodes\": {";
+  const char *separator = "\n";
+  for (std::size_t id = 0; id < opcode_count; ++id) {
+    out << separator << "    \"" << opcode_names[id]
+        << "\": " << profile.opcodes[id];
+    separator = ",\n";
+  }
+  out << "\n  },\n  \"prog_counters\": {";
+  separator = "\n";
+  for (std::size_t addr = 0; addr < profile.prog_counters.size(); ++addr) {
+    if (profile.prog_counters[addr] != 0) {
+      out << separator << "    \"" << addr
+          << "\": " << profile.prog_counters[addr];
+      separator = ",\n";
+    }
+  }
+  out << "\n  },\n  \"sprite_pixels\": " << profile.sprite_pixels
+      << ",\n  \"key_polls\": " << profile.key_polls
+      << ",\n  \"frame_instructions\": [";
+  separator = "\n";
+  for (std::size_t bucket = 0; bucket < frame_buckets; ++bucket) {
+    if (profile.frame_instructions[bucket] != 0) {
+      out << separator << "    {\"min\": " << bucket_floor(bucket)
+          << ", \"frames\": " << profile.frame_instructions[bucket] << "}";
+      separator = ",\n";
+    }
+  }
+  out << "\n  ]\n}\n";
+}
+
+void write_profile_csv(std::ostream &out, const chip8_profile &profile) {
+  out << "kind,key,count\n";
+  for (std::size_t id = 0; id < opcode_count; ++id) {
+    out << "opcode," << opcode_names[id] << ',' << profile.opcodes[id]
+        << '\n';
+  }
+  for (std::size_t addr = 0; addr < profile.prog_counters.size(); ++addr) {
+    if (profile.prog_counters[addr] != 0) {
+      out << "prog_counter," << addr << ',' << profile.prog_counters[addr]
+          << '\n';
+    }
+  }
+  out << "sprite_pixels,," << profile.sprite_pixels << '\n';
+  out << "key_polls,," << profile.key_polls << '\n';
+  for (std::size_t bucket = 0; bucket < frame_buckets; ++bucket) {
+    if (profile.frame_instructions[bucket] != 0) {
+      out << "frame_instructions," << bucket_floor(bucket) << ','
+          << profile.frame_instructions[bucket] << '\n';
+    }
+  }
+}
@@ -0,0 +1,166 @@
+#include "rewind_buffer.hpp"
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+static constexpr std::size_t state_size = sizeof(chip8_state);
+static constexpr auto no_offset = std::numeric_limits<std::size_t>::max();
+// A delta is a list of tokens: bytes to skip, bytes to XOR, the XOR bytes
+static constexpr std::size_t token_size = 2 * sizeof(uint16_t);
+static_assert(state_size <= std::numeric_limits<uint16_t>::max(),
+              "delta tokens count bytes in 16 bits");
+
+rewind_buffer::rewind_buffer(const std::size_t bytes,
+                             const std::size_t max_frames,
+                             const std::size_t interval)
+    : storage(bytes), entries(max_frames), scratch(state_size),
+      keyframe_interval{interval} {
+  if (bytes < 2 * state_size || max_frames == 0 || interval == 0) {
+    throw std::invalid_argument("Rewind buffer is too small");
+  }
+}
+
+rewind_buffer::entry &rewind_buffer::at(const std::size_t seq) {
+  return entries[seq % entries.size()];
+}
+
+std::size_t rewind_buffer::size() const { return next_seq - first_seq; }
+
+std::size_t rewind_buffer::bytes_used() const { return used; }
+
+void rewind_buffer::clear() {
+  first_seq = next_seq;
+  used = 0;
+}
+
+void rewind_buffer::drop_oldest_group() {
+  do {
+    used -= at(first_seq).length;
+    ++first_seq;
+  } while (first_seq < next_seq && at(first_seq).keyframe != first_seq);
+}
+
+// Entries sit back to back in storage, wrapping to the start when the end
+// is reached. Old groups are dropped until there is room, unless that
+// would drop the keyframe in protect
+std::size_t rewind_buffer::allocate(const std::size_t length,
+                                    const std::size_t protect) {
+  while (size() > 0) {
+    const auto begin = at(first_seq).offset;
+    const auto &newest = at(next_seq - 1);
+    const auto end = newest.offset + newest.length;
+    if (newest.offset >= begin) {
+      if (storage.size() - end >= length) {
+        return end;
+      }
+      if (begin >= length) {
+        return 0;
+      }
+    } else if (begin - end >= length) {
+      return end;
+    }
+    if (first_seq == protect) {
+      return no_offset;
+    }
+    drop_oldest_group();
+  }
+  return 0;
+}
+
+std::size_t rewind_buffer::encode_delta(const chip8_state &state,
+                                        const uint8_t *keyframe) {
+  const auto *bytes = reinterpret_cast<const uint8_t *>(&state);
+  std::size_t length = 0;
+  std::size_t pos = 0;
+  while (pos < state_size) {
+    const auto skip_begin = pos;
+    while (pos < state_size && bytes[pos] == keyframe[pos]) {
+      ++pos;
+    }
+    if (pos == state_size) {
+      break;
+    }
+    const auto xor_begin = pos;
+    while (pos < state_size && bytes[pos] != keyframe[pos]) {
+      ++pos;
+    }
+    const auto skip = static_cast<uint16_t>(xor_begin - skip_begin);
+    const auto count = static_cast<uint16_t>(pos - xor_begin);
+    // Not worth it, the caller stores a keyframe instead
+    if (length + token_size + count >= state_size) {
+      return state_size;
+    }
+    std::memcpy(&scratch[length], &skip, sizeof(skip));
+    std::memcpy(&scratch[length + sizeof(skip)], &count, sizeof(count));
+    length += token_size;
+    for (auto i = xor_begin; i < pos; ++i) {
+      scratch[length++] = static_cast<uint8_t>(bytes[i] ^ keyframe[i]);
+    }
+  }
+  // An unchanged frame still takes one empty token, entries are never
+  // empty so the ring can tell full from wrapped
+  if (length == 0) {
+    std::memset(scratch.data(), 0, token_size);
+    length = token_size;
+  }
+  return length;
+}
+
+void rewind_buffer::push(const chip8_state &state) {
+  if (size() == entries.size()) {
+    drop_oldest_group();
+  }
+  std::size_t keyframe = next_seq;
+  std::size_t length = state_size;
+  std::size_t offset = no_offset;
+  if (size() > 0) {
+    const auto newest_keyframe = at(next_seq - 1).keyframe;
+    if (next_seq - newest_keyframe < keyframe_interval) {
+      length =
+          encode_delta(state, storage.data() + at(newest_keyframe).offset);
+      if (length < state_size) {
+        offset = allocate(length, newest_keyframe);
+        keyframe = newest_keyframe;
+      }
+    }
+  }
+  if (offset == no_offset) {
+    keyframe = next_seq;
+    length = state_size;
+    offset = allocate(length, no_offset);
+    std::memcpy(storage.data() + offset, &state, state_size);
+  } else {
+    std::memcpy(storage.data() + offset, scratch.data(), length);
+  }
+  at(next_seq) = {offset, length, keyframe};
+  ++next_seq;
+  used += length;
+}
+
+bool rewind_buffer::pop(chip8_state &state) {
+  if (size() == 0) {
+    return false;
+  }
+  const auto newest = at(next_seq - 1);
+  auto *bytes = reinterpret_cast<uint8_t *>(&state);
+  std::memcpy(bytes, storage.data() + at(newest.keyframe).offset, state_size);
+  if (newest.keyframe != next_seq - 1) {
+    const auto *delta = storage.data() + newest.offset;
+    std::size_t read = 0;
+    std::size_t pos = 0;
+    while (read < newest.length) {
+      uint16_t skip = 0;
+      uint16_t count = 0;
+      std::memcpy(&skip, delta + read, sizeof(skip));
+      std::memcpy(&count, delta + read + sizeof(skip), sizeof(count));
+      read += token_size;
+      pos += skip;
+      for (std::size_t i = 0; i < count; ++i) {
+        bytes[pos++] ^= delta[read++];
+      }
+    }
+  }
+  --next_seq;
+  used -= newest.length;
+  return true;
+}
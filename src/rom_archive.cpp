@@ -0,0 +1,77 @@
+#include "rom_archive.hpp"
+#include "chip8.hpp"
+#include "hash.hpp"
+
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+
+void write_archive(const std::string &file_name,
+                   const std::vector<archive_rom> &roms) {
+  archive_header header;
+  header.count = static_cast<uint32_t>(roms.size());
+  std::vector<archive_entry> index(roms.size());
+
+  // Names right after the index, then the data of every distinct ROM
+  std::size_t end = sizeof(header) + index.size() * sizeof(archive_entry);
+  for (std::size_t i = 0; i < roms.size(); ++i) {
+    const auto &name = roms[i].name;
+    if (name.size() > std::numeric_limits<uint16_t>::max()) {
+      throw std::length_error("ROM name " + name + " is too long");
+    }
+    index[i].name_offset = static_cast<uint32_t>(end);
+    index[i].name_length = static_cast<uint16_t>(name.size());
+    end += name.size();
+  }
+  std::vector<const archive_rom *> stored;
+  std::unordered_multimap<uint64_t, std::size_t> by_hash;
+  for (std::size_t i = 0; i < roms.size(); ++i) {
+    const auto &rom = roms[i];
+    if (rom.data.empty() || rom.data.size() > max_rom_size) {
+      throw std::length_error(rom.name + " is not a ROM of 1 to " +
+                              std::to_string(max_rom_size) + " bytes");
+    }
+    auto &entry = index[i];
+    entry.hash = fnv1a(rom.data.data(), rom.data.size());
+    entry.length = static_cast<uint32_t>(rom.data.size());
+    entry.clock_hz = rom.clock_hz;
+    entry.quirks = rom.quirks;
+    const auto [first, last] = by_hash.equal_range(entry.hash);
+    for (auto candidate = first; candidate != last; ++candidate) {
+      if (roms[candidate->second].data == rom.data) {
+        entry.offset = index[candidate->second].offset;
+        break;
+      }
+    }
+    if (entry.offset == 0) {
+      entry.offset = static_cast<uint32_t>(end);
+      end += rom.data.size();
+      stored.push_back(&rom);
+      by_hash.emplace(entry.hash, i);
+    }
+    if (end > std::numeric_limits<uint32_t>::max()) {
+      throw std::length_error("The archive would be larger than 4 GB");
+    }
+  }
+
+  std::ofstream file(file_name, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    throw std::invalid_argument("Could not create archive " + file_name);
+  }
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char *>(index.data()),
+             static_cast<std::streamsize>(index.size() *
+                                          sizeof(archive_entry)));
+  for (const auto &rom : roms) {
+    file.write(rom.name.data(), static_cast<std::streamsize>(rom.name.size()));
+  }
+  for (const auto *rom : stored) {
+    file.write(reinterpret_cast<const char *>(rom->data.data()),
+               static_cast<std::streamsize>(rom->data.size()));
+  }
+  file.flush();
+  if (!file) {
+    throw std::runtime_error("Could not write archive " + file_name);
+  }
+}
@@ -0,0 +1,206 @@
+#include "rom_store.hpp"
+#include "hash.hpp"
+#include "rom_archive.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Grows like push_back would, so that the push_back after it can not throw
+template <typename T> static void make_room(std::vector<T> &items) {
+  if (items.size() == items.capacity()) {
+    items.reserve(items.size() * 2 + 1);
+  }
+}
+
+rom_store::~rom_store() {
+  for (const auto &region : mappings) {
+    unmap(region);
+  }
+}
+
+rom_store::mapping rom_store::map_file(const std::string &file_name) {
+  const int fd = ::open(file_name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::invalid_argument("Given filename " + file_name +
+                                " does not exist!");
+  }
+  struct stat info {};
+  if (::fstat(fd, &info) != 0) {
+    ::close(fd);
+    throw std::runtime_error("Could not read the size of " + file_name);
+  }
+  const auto length = static_cast<std::size_t>(info.st_size);
+  if (length == 0) {
+    ::close(fd);
+    throw std::length_error(file_name + " is empty");
+  }
+  void *address = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping stays valid after the descriptor is closed
+  ::close(fd);
+  if (address == MAP_FAILED) {
+    throw std::runtime_error("Could not map " + file_name);
+  }
+  return {address, length};
+}
+
+void rom_store::unmap(const mapping &region) {
+  ::munmap(region.address, region.length);
+}
+
+std::size_t rom_store::find_or_add(const rom_entry &image, bool &added) {
+  const auto [first, last] = by_hash.equal_range(image.hash);
+  for (auto candidate = first; candidate != last; ++candidate) {
+    const auto &known = images[candidate->second];
+    if (known.size == image.size &&
+        std::equal(image.data, image.data + image.size, known.data)) {
+      added = false;
+      return candidate->second;
+    }
+  }
+  make_room(images);
+  by_hash.emplace(image.hash, images.size());
+  images.push_back(image);
+  added = true;
+  return images.size() - 1;
+}
+
+std::size_t rom_store::add_file(const std::string &file_name) {
+  const auto region = map_file(file_name);
+  if (region.length > max_rom_size) {
+    unmap(region);
+    throw std::length_error(file_name + " is not a ROM of 1 to " +
+                            std::to_string(max_rom_size) + " bytes");
+  }
+  const auto *data = static_cast<const uint8_t *>(region.address);
+  const rom_entry image{data, region.length, fnv1a(data, region.length)};
+  bool added = false;
+  std::size_t index = 0;
+  try {
+    // Nothing below the lookup may throw once the image is known
+    make_room(mappings);
+    make_room(roms);
+    make_room(infos);
+    infos.push_back({file_name, 0, 0});
+    index = find_or_add(image, added);
+  } catch (...) {
+    if (infos.size() > roms.size()) {
+      infos.pop_back();
+    }
+    unmap(region);
+    throw;
+  }
+  // A duplicate keeps pointing at the first copy
+  if (added) {
+    mappings.push_back(region);
+  } else {
+    unmap(region);
+  }
+  roms.push_back(index);
+  return roms.size() - 1;
+}
+
+// Reads the whole index before adding anything, so a damaged archive
+// leaves the store as it was
+static std::vector<archive_entry> read_index(const uint8_t *file,
+                                             std::size_t length,
+                                             const std::string &file_name) {
+  const auto damaged = [&file_name](const std::string &what) {
+    return std::invalid_argument(file_name + " is not a ROM archive: " +
+                                 what);
+  };
+  archive_header header;
+  if (length < sizeof(header)) {
+    throw damaged("too short");
+  }
+  std::memcpy(&header, file, sizeof(header));
+  if (header.magic != archive_magic || header.version != archive_version) {
+    throw damaged("unknown format");
+  }
+  if (header.count > (length - sizeof(header)) / sizeof(archive_entry)) {
+    throw damaged("index is cut off");
+  }
+  std::vector<archive_entry> index(header.count);
+  std::memcpy(index.data(), file + sizeof(header),
+              index.size() * sizeof(archive_entry));
+  for (const auto &entry : index) {
+    if (entry.length == 0 || entry.length > max_rom_size ||
+        entry.offset > length || entry.length > length - entry.offset ||
+        entry.name_offset > length ||
+        entry.name_length > length - entry.name_offset) {
+      throw damaged("entry out of bounds");
+    }
+    if (fnv1a(file + entry.offset, entry.length) != entry.hash) {
+      throw damaged("hash mismatch");
+    }
+  }
+  return index;
+}
+
+std::size_t rom_store::add_archive(const std::string &file_name) {
+  const auto region = map_file(file_name);
+  const auto *file = static_cast<const uint8_t *>(region.address);
+  const auto first_rom = roms.size();
+  const auto first_image = images.size();
+  try {
+    const auto index = read_index(file, region.length, file_name);
+    make_room(mappings);
+    roms.reserve(roms.size() + index.size());
+    infos.reserve(infos.size() + index.size());
+    images.reserve(images.size() + index.size());
+    for (const auto &entry : index) {
+      const auto *name =
+          reinterpret_cast<const char *>(file + entry.name_offset);
+      infos.push_back(
+          {{name, entry.name_length}, entry.clock_hz, entry.quirks});
+      bool added = false;
+      roms.push_back(find_or_add(
+          {file + entry.offset, entry.length, entry.hash}, added));
+    }
+  } catch (...) {
+    // Forget what was added from this file before unmapping it
+    for (auto i = first_image; i < images.size(); ++i) {
+      const auto [first, last] = by_hash.equal_range(images[i].hash);
+      for (auto candidate = first; candidate != last; ++candidate) {
+        if (candidate->second == i) {
+          by_hash.erase(candidate);
+          break;
+        }
+      }
+    }
+    images.resize(first_image);
+    roms.resize(first_rom);
+    infos.resize(first_rom);
+    unmap(region);
+    throw;
+  }
+  // Every ROM in it may already be known
+  if (images.size() > first_image) {
+    mappings.push_back(region);
+  } else {
+    unmap(region);
+  }
+  return first_rom;
+}
+
+std::size_t rom_store::size() const { return roms.size(); }
+
+std::size_t rom_store::unique_count() const { return images.size(); }
+
+const rom_entry &rom_store::get(const std::size_t index) const {
+  return images[roms.at(index)];
+}
+
+const rom_info &rom_store::info(const std::size_t index) const {
+  return infos.at(index);
+}
+
+void rom_store::load(const std::size_t index, chip8 &machine) const {
+  const auto &image = get(index);
+  machine.load_mapped(image.data, image.size);
+}
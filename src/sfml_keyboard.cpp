@@ -0,0 +1,31 @@
+#include "sfml_keyboard.hpp"
+#include <array>
+#include <utility>
+
+static constexpr std::array<std::pair<sf::Keyboard::Key, int>, 16> keymap{{
+    {sf::Keyboard::Num5, 0x01},
+    {sf::Keyboard::Num6, 0x02},
+    {sf::Keyboard::Num7, 0x03},
+    {sf::Keyboard::Num8, 0x0C},
+    {sf::Keyboard::T, 0x04},
+    {sf::Keyboard::Y, 0x05},
+    {sf::Keyboard::U, 0x06},
+    {sf::Keyboard::I, 0x0D},
+    {sf::Keyboard::G, 0x07},
+    {sf::Keyboard::H, 0x08},
+    {sf::Keyboard::J, 0x09},
+    {sf::Keyboard::K, 0x0E},
+    {sf::Keyboard::B, 0x0A},
+    {sf::Keyboard::N, 0x00},
+    {sf::Keyboard::M, 0x0B},
+    {sf::Keyboard::Comma, 0x0F},
+}};
+
+int keypad_index(const sf::Keyboard::Key key) {
+  for (const auto &[host, index] : keymap) {
+    if (host == key) {
+      return index;
+    }
+  }
+  return -1;
+}
@@ -1,6 +1,22 @@
 #include "catch2/catch.hpp"
 #include "chip8.hpp"
+#include "chip8_pool.hpp"
+#include "disassembler.hpp"
+#include "lockstep_chip8.hpp"
 #include "mock_keyboard.hpp"
+#include "movie.hpp"
+#include "rewind_buffer.hpp"
+#include "rom_archive.hpp"
+#include "rom_store.hpp"
+#include "triple_buffer.hpp"
+#include <algorithm>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
 
 TEST_CASE("Opcodes for Data Registers") {
   chip8 emulator;
@@ -230,6 +246,22 @@ TEST_CASE("Opcodes for Data Registers") {
 
     REQUIRE(actual_V[5] < 0xDD);
   }
+  SECTION("CXNN is reproducible for a seed") {
+    std::vector<uint8_t> rom{0xC0, 0xFF, 0xC1, 0xFF, 0xC2, 0xFF, 0xC3, 0xFF};
+    chip8 same_seed;
+    chip8 other_seed;
+    emulator.seed_rng(1234);
+    same_seed.seed_rng(1234);
+    other_seed.seed_rng(4321);
+    for (auto *machine : {&emulator, &same_seed, &other_seed}) {
+      machine->load_memory(rom);
+      machine->run(4);
+    }
+
+    REQUIRE(emulator.get_V_registers() == same_seed.get_V_registers());
+    REQUIRE(emulator.get_V_registers() != other_seed.get_V_registers());
+    REQUIRE(emulator.get_state().rng == same_seed.get_state().rng);
+  }
 }
 TEST_CASE("Opcodes for Flow Control with Jumps") {
   chip8 emulator;
@@ -284,6 +316,46 @@ TEST_CASE("Opcodes for Subroutines") {
     REQUIRE(actual_V[1] == (0x36));
     REQUIRE(actual_V[5] == (0x56));
   }
+  SECTION("00EE RET with an empty stack faults") {
+    std::vector<uint8_t> rom{0x00, 0xEE, 0x61, 0x32};
+
+    emulator.load_memory(rom);
+    emulator.step_one_cycle();
+    emulator.step_one_cycle();
+
+    REQUIRE(emulator.get_fault() == fault::stack_underflow);
+    REQUIRE(emulator.get_prog_counter() == 0x200);
+    REQUIRE(emulator.get_V_registers()[1] == 0);
+  }
+  SECTION("2NNN CALL beyond the stack depth faults") {
+    // CALL 0x200 recursively
+    std::vector<uint8_t> rom{0x22, 0x00};
+
+    emulator.load_memory(rom);
+    for (std::size_t call = 0; call < stack_depth; call++) {
+      emulator.step_one_cycle();
+    }
+    REQUIRE(emulator.get_fault() == fault::none);
+    REQUIRE(emulator.get_state().stack_pointer == stack_depth);
+    emulator.step_one_cycle();
+
+    REQUIRE(emulator.get_fault() == fault::stack_overflow);
+    REQUIRE(emulator.get_prog_counter() == 0x200);
+  }
+  SECTION("Reloading after a fault runs the new ROM") {
+    std::vector<uint8_t> recursive{0x22, 0x02, 0x22, 0x02};
+    std::vector<uint8_t> rom{0x61, 0x32};
+
+    emulator.load_memory(recursive);
+    emulator.run(stack_depth + 2);
+    REQUIRE(emulator.get_fault() == fault::stack_overflow);
+    emulator.load_memory(rom);
+    REQUIRE(emulator.get_fault() == fault::none);
+    REQUIRE(emulator.get_prog_counter() == 0x200);
+    REQUIRE(emulator.get_state().stack_pointer == 0);
+    emulator.step_one_cycle();
+    REQUIRE(emulator.get_V_registers()[1] == 0x32);
+  }
 }
 TEST_CASE("Opcodes for Conditional Branching using Skips") {
   chip8 emulator;
@@ -404,7 +476,8 @@ TEST_CASE("Opcodes for Timers") {
     emulator.step_one_cycle();
     auto actual_V = emulator.get_V_registers();
 
-    REQUIRE(actual_V[8] == 0x31);
+    // Three instructions at 600 Hz are less than one 60 Hz timer tick
+    REQUIRE(actual_V[8] == 0x32);
   }
   SECTION("FX18 LDA Sound timer") {
     std::vector<uint8_t> rom{0x6C, 0x32, 0xFC, 0x18};
@@ -416,6 +489,40 @@ TEST_CASE("Opcodes for Timers") {
     REQUIRE(emulator.get_sound_counter() == 0x32);
   }
 }
+TEST_CASE("Timers run at 60 Hz of emulated time") {
+  // DT = ST = 0xFF, then loop forever
+  std::vector<uint8_t> rom{0x60, 0xFF, 0xF0, 0x15, 0xF0, 0x18, 0x12, 0x06};
+  chip8 emulator;
+  emulator.load_memory(rom);
+
+  SECTION("run_frame ends on a timer tick") {
+    emulator.run_frame();
+    REQUIRE(emulator.get_delay_counter() == 0xFE);
+    REQUIRE(emulator.get_state().timer_phase == 0);
+    emulator.run_frame();
+    REQUIRE(emulator.get_delay_counter() == 0xFD);
+    REQUIRE(emulator.get_sound_counter() == 0xFD);
+  }
+  SECTION("The clock rate does not change the timer speed") {
+    emulator.set_clock_hz(1000);
+    emulator.run_for(std::chrono::seconds{1});
+    REQUIRE(emulator.get_delay_counter() == 0xFF - 60);
+
+    emulator.set_clock_hz(540);
+    emulator.run_for(std::chrono::milliseconds{500});
+    REQUIRE(emulator.get_delay_counter() == 0xFF - 90);
+  }
+  SECTION("run_for carries partial instructions over") {
+    // 600 Hz is 0.6 instructions per millisecond
+    for (int ms = 0; ms < 1000; ++ms) {
+      emulator.run_for(std::chrono::milliseconds{1});
+    }
+    REQUIRE(emulator.get_delay_counter() == 0xFF - 60);
+  }
+  SECTION("The clock can not be slower than the timers") {
+    REQUIRE_THROWS_AS(emulator.set_clock_hz(59), std::invalid_argument);
+  }
+}
 TEST_CASE("Opcodes for I registers") {
   chip8 emulator;
   SECTION("ANNN STA NNN in I register") {
@@ -500,6 +607,48 @@ TEST_CASE("Opcodes for Graphics") {
       REQUIRE(disp.at((5 + (display_x * 7) + i)) == 0);
     }
   }
+  SECTION("DXYN sets VF only on collision") {
+    std::vector<uint8_t> rom{0x61, 0x05, 0x62, 0x05, 0xD1, 0x21, 0xD1, 0x21};
+
+    emulator.load_memory(rom);
+    emulator.step_one_cycle();
+    emulator.step_one_cycle();
+    emulator.step_one_cycle();
+    REQUIRE(emulator.get_V_registers().at(0xF) == 0);
+    emulator.step_one_cycle();
+    REQUIRE(emulator.get_V_registers().at(0xF) == 1);
+  }
+  SECTION("DXYN clips at the right and bottom edges") {
+    // "0" drawn at (62, 31): only the first two pixels of the first row fit
+    std::vector<uint8_t> rom{0x61, 0x3E, 0x62, 0x1F, 0xD1, 0x25};
+
+    emulator.load_memory(rom);
+    emulator.step_one_cycle();
+    emulator.step_one_cycle();
+    emulator.step_one_cycle();
+    auto disp = emulator.get_display_pixels();
+
+    REQUIRE(disp.at(62 + (display_x * 31)) == 1);
+    REQUIRE(disp.at(63 + (display_x * 31)) == 1);
+    REQUIRE(disp.at(0 + (display_x * 31)) == 0);
+    REQUIRE(disp.at(62 + (display_x * 0)) == 0);
+    REQUIRE(std::count(disp.begin(), disp.end(), 1) == 2);
+  }
+  SECTION("DXYN wraps the start position") {
+    // (69, 37) wraps to (5, 5)
+    std::vector<uint8_t> rom{0x61, 0x45, 0x62, 0x25, 0xD1, 0x21};
+
+    emulator.load_memory(rom);
+    emulator.step_one_cycle();
+    emulator.step_one_cycle();
+    emulator.step_one_cycle();
+    auto disp = emulator.get_display_pixels();
+
+    for (size_t i = 0; i < 8; i++) {
+      REQUIRE(disp.at(5 + (display_x * 5) + i) ==
+              ((0xF0 & (0x80 >> i)) > 0 ? 1 : 0));
+    }
+  }
   SECTION("00E0 CLR DISPLAY") {
     std::vector<uint8_t> rom{0x61, 0x05, 0x62, 0x05, 0xD1, 0x21, 0x00, 0xE0};
 
@@ -514,6 +663,18 @@ TEST_CASE("Opcodes for Graphics") {
       REQUIRE(disp.at((5 + (display_x * 5) + i)) == 0);
     }
   }
+  SECTION("present reports the rows changed since the last call") {
+    // "0" is five rows high, drawn at row 5, then the screen is cleared
+    std::vector<uint8_t> rom{0x61, 0x05, 0x62, 0x05, 0xD1, 0x25, 0x00, 0xE0};
+
+    emulator.load_memory(rom);
+    REQUIRE(emulator.present() == 0);
+    emulator.run(3);
+    REQUIRE(emulator.present() == (0x1FU << 5U));
+    REQUIRE(emulator.present() == 0);
+    emulator.step_one_cycle();
+    REQUIRE(emulator.present() == (0x1FU << 5U));
+  }
   SECTION("FX29 LDA I with hex font address") {
     // LDA font for F
     std::vector<uint8_t> rom{0x61, 0x05, 0x62, 0x05, 0x6D, 0x0F, 0xFD, 0x29, 0xD1, 0x11};
@@ -616,6 +777,153 @@ TEST_CASE("Opcodes for Register Values and Memory Storage") {
   }
 }
 
+TEST_CASE("Decoded instruction cache") {
+  chip8 emulator;
+  SECTION("FX55 overwrites an instruction that already ran") {
+    // STA 0x65 in V0 and 0x77 in V1
+    // STA 0x33 in V5 (decoded and cached)
+    // Set I to 0x204 and copy V0, V1 over the previous instruction
+    // JMP back to 0x204, which now reads 65 77
+    std::vector<uint8_t> rom{0x60, 0x65, 0x61, 0x77, 0x65, 0x33,
+                             0xA2, 0x04, 0xF1, 0x55, 0x12, 0x04};
+
+    emulator.load_memory(rom);
+    for (int cycle = 0; cycle < 5; cycle++) {
+      emulator.step_one_cycle();
+    }
+    REQUIRE(emulator.get_V_registers()[5] == 0x33);
+    emulator.step_one_cycle();
+    emulator.step_one_cycle();
+
+    REQUIRE(emulator.get_V_registers()[5] == 0x77);
+  }
+  SECTION("load_memory drops the cached instructions") {
+    std::vector<uint8_t> jmp_to_self{0x12, 0x00};
+    std::vector<uint8_t> sta_in_V1{0x61, 0x22};
+
+    emulator.load_memory(jmp_to_self);
+    emulator.step_one_cycle();
+    emulator.load_memory(sta_in_V1);
+    emulator.step_one_cycle();
+
+    REQUIRE(emulator.get_V_registers()[1] == 0x22);
+  }
+  SECTION("Reloading a rewritten program restores it") {
+    // The FX55 program above, loaded again once it overwrote 0x204
+    std::vector<uint8_t> rom{0x60, 0x65, 0x61, 0x77, 0x65, 0x33,
+                             0xA2, 0x04, 0xF1, 0x55, 0x12, 0x04};
+    for (const auto selected : {backend::interpreter, backend::threaded}) {
+      chip8 machine{selected};
+      machine.load_memory(rom);
+      machine.run(7);
+      REQUIRE(machine.get_V_registers()[5] == 0x77);
+      machine.load_memory(rom);
+      machine.run(3);
+      REQUIRE(machine.get_V_registers()[5] == 0x33);
+    }
+  }
+}
+
+static void require_same_state(const chip8 &lhs, const chip8 &rhs) {
+  const auto &lhs_state = lhs.get_state();
+  const auto &rhs_state = rhs.get_state();
+  REQUIRE(lhs_state.V == rhs_state.V);
+  REQUIRE(lhs_state.I == rhs_state.I);
+  REQUIRE(lhs_state.prog_counter == rhs_state.prog_counter);
+  REQUIRE(lhs_state.delay_timer == rhs_state.delay_timer);
+  REQUIRE(lhs_state.sound_timer == rhs_state.sound_timer);
+  REQUIRE(lhs_state.timer_phase == rhs_state.timer_phase);
+  REQUIRE(lhs_state.rng == rhs_state.rng);
+  REQUIRE(lhs_state.hw_stack == rhs_state.hw_stack);
+  REQUIRE(lhs_state.stack_pointer == rhs_state.stack_pointer);
+  REQUIRE(lhs_state.error == rhs_state.error);
+  REQUIRE(lhs_state.memory == rhs_state.memory);
+  REQUIRE(lhs_state.display == rhs_state.display);
+  REQUIRE(lhs.get_display_flag() == rhs.get_display_flag());
+}
+
+TEST_CASE("Threaded backend matches the interpreter") {
+  // ROMs of the opcode tests above, plus a loop with a subroutine that
+  // draws digits, clipped at the bottom edge, and stores BCD digits, and
+  // the self-modifying FX55 program
+  const std::vector<std::vector<uint8_t>> roms{
+      {0x61, 0x32, 0x63, 0xF1, 0x81, 0x34},
+      {0x61, 0x32, 0x63, 0x36, 0x81, 0x35},
+      {0x61, 0x32, 0x63, 0x26, 0x81, 0x37},
+      {0x69, 0x32, 0x65, 0x86, 0x89, 0x56},
+      {0x69, 0x32, 0x65, 0x86, 0x89, 0x5E},
+      {0x60, 0x32, 0xB7, 0xDD},
+      {0x61, 0x32, 0x22, 0x06, 0x65, 0x56, 0x61, 0x36, 0x00, 0xEE},
+      {0x61, 0x32, 0x00, 0xEE, 0x61, 0x36},
+      {0x68, 0x32, 0x38, 0x32, 0x68, 0x82, 0x68, 0x12},
+      {0x68, 0x32, 0x67, 0x34, 0x98, 0x70, 0x68, 0x82, 0x68, 0x12},
+      {0x68, 0x32, 0xF8, 0x15, 0xF8, 0x07, 0xFC, 0x18},
+      {0x61, 0x05, 0x62, 0x05, 0xD1, 0x13, 0xD1, 0x23, 0x00, 0xE0},
+      {0xC3, 0xFF, 0xC4, 0x0F, 0xC5, 0xF0, 0x84, 0x34, 0x12, 0x00},
+      {0xA1, 0x00, 0x6F, 0xF1, 0xFF, 0x55, 0x6F, 0x11, 0xA1, 0x00, 0xFF,
+       0x65},
+      {0x60, 0x65, 0x61, 0x77, 0x65, 0x33, 0xA2, 0x04, 0xF1, 0x55, 0x12,
+       0x04},
+      {0x60, 0x00, 0x22, 0x10, 0x70, 0x01, 0x30, 0x20, 0x12, 0x02, 0x12,
+       0x0A, 0x00, 0x00, 0x00, 0x00, 0x81, 0x04, 0xF0, 0x29, 0xD0, 0x15,
+       0xA3, 0x00, 0xF1, 0x33, 0x00, 0xEE}};
+
+  for (const auto &rom : roms) {
+    const auto num_cycles = (rom.size() > 12) ? 200U : rom.size() / 2;
+    chip8 interpreter;
+    chip8 threaded{backend::threaded};
+    chip8 threaded_single_step{backend::threaded};
+    interpreter.load_memory(rom);
+    threaded.load_memory(rom);
+    threaded_single_step.load_memory(rom);
+
+    for (std::size_t cycle = 0; cycle < num_cycles; cycle++) {
+      interpreter.step_one_cycle();
+      threaded_single_step.run(1);
+      require_same_state(interpreter, threaded_single_step);
+    }
+    threaded.run(num_cycles);
+    require_same_state(interpreter, threaded);
+  }
+}
+
+TEST_CASE("Threaded backend with more than 64K compiled ops") {
+  // BNNN enters a run of 7101 at every even address, so every entry
+  // compiles its own block of up to 64 ops. The run ends in 00EE
+  constexpr std::size_t bases = 11;
+  constexpr std::size_t body = 0x300;
+  std::vector<uint8_t> rom(body - prog_mem_begin + bases * 256, 0);
+  auto put = [&rom](std::size_t addr, uint16_t opcode) {
+    rom[addr - prog_mem_begin] = static_cast<uint8_t>(opcode >> 8);
+    rom[addr - prog_mem_begin + 1] = static_cast<uint8_t>(opcode);
+  };
+  const std::size_t subs = prog_mem_begin + bases * 8 + 2;
+  for (std::size_t base = 0; base < bases; ++base) {
+    // Calls base + V0 for V0 = 0, 2, ... 254
+    const auto loop = prog_mem_begin + base * 8;
+    put(loop, static_cast<uint16_t>(0x2000 + subs + base * 2));
+    put(loop + 2, 0x7002);
+    put(loop + 4, 0x3000);
+    put(loop + 6, static_cast<uint16_t>(0x1000 + loop));
+    put(subs + base * 2, static_cast<uint16_t>(0xB000 + body + base * 256));
+  }
+  const std::size_t halt = prog_mem_begin + bases * 8;
+  put(halt, static_cast<uint16_t>(0x1000 + halt));
+  for (auto addr = body; addr < body + bases * 256 - 2; addr += 2) {
+    put(addr, 0x7101);
+  }
+  put(body + bases * 256 - 2, 0x00EE);
+
+  chip8 interpreter;
+  chip8 threaded{backend::threaded};
+  interpreter.load_memory(rom);
+  threaded.load_memory(rom);
+  interpreter.run(1'200'000);
+  threaded.run(1'200'000);
+  REQUIRE(interpreter.get_prog_counter() == halt);
+  require_same_state(interpreter, threaded);
+}
+
 TEST_CASE("OPCODES with Keyboard input") {
   using trompeloeil::_;
   std::unique_ptr<mockKeyboard> mockKeyb{new mockKeyboard};
@@ -705,3 +1013,800 @@ TEST_CASE("OPCODES with Keyboard input") {
     REQUIRE(actual_V[0x02] == (0x0));
   }
 }
+TEST_CASE("OPCODES with keypad bitmask") {
+  chip8 emulator;
+  SECTION("EX9E and EXA1 test a single key") {
+    // V1 = 5, then EX9E and EXA1 on it
+    std::vector<uint8_t> rom{0x61, 0x05, 0xE1, 0x9E, 0x00, 0x00, 0xE1, 0xA1};
+
+    emulator.load_memory(rom);
+    emulator.press_key(0x05);
+    emulator.press_key(0x07);
+    emulator.step_one_cycle();
+    emulator.step_one_cycle();
+    REQUIRE(emulator.get_prog_counter() == prog_mem_begin + 6);
+
+    emulator.release_key(0x05);
+    emulator.step_one_cycle();
+    REQUIRE(emulator.get_prog_counter() == prog_mem_begin + 10);
+    REQUIRE(emulator.get_Keys_array().at(0x07));
+    REQUIRE_FALSE(emulator.get_Keys_array().at(0x05));
+  }
+  SECTION("Keys stay held across instructions") {
+    std::vector<uint8_t> rom{0x61, 0x05, 0xE1, 0x9E, 0x00, 0x00, 0xE1, 0x9E};
+
+    emulator.load_memory(rom);
+    emulator.set_keys(1U << 5U);
+    emulator.run(2);
+    emulator.step_one_cycle();
+    REQUIRE(emulator.get_prog_counter() == prog_mem_begin + 10);
+  }
+  SECTION("FX0A waits, then takes the lowest held key") {
+    std::vector<uint8_t> rom{0xF2, 0x0A};
+
+    emulator.load_memory(rom);
+    emulator.step_one_cycle();
+    REQUIRE(emulator.get_prog_counter() == prog_mem_begin);
+
+    emulator.set_keys((1U << 0xCU) | (1U << 0x3U));
+    emulator.step_one_cycle();
+    REQUIRE(emulator.get_prog_counter() == prog_mem_begin + 2);
+    REQUIRE(emulator.get_V_registers().at(0x02) == 0x03);
+  }
+}
+TEST_CASE("Opcode decode table") {
+  SECTION("Operands are extracted once") {
+    const auto &instr = lookup(0xD1A5);
+
+    REQUIRE(instr.id == opcode_id::OP_DXYN);
+    REQUIRE(instr.X == 0x1);
+    REQUIRE(instr.Y == 0xA);
+    REQUIRE(instr.N == 0x5);
+    REQUIRE(instr.NN == 0xA5);
+    REQUIRE(instr.NNN == 0x1A5);
+  }
+  SECTION("Sub-opcodes of the 0x0, 0x8, 0xE and 0xF groups") {
+    REQUIRE(lookup(0x00E0).id == opcode_id::OP_00E0);
+    REQUIRE(lookup(0x00EE).id == opcode_id::OP_00EE);
+    REQUIRE(lookup(0x812E).id == opcode_id::OP_8XYE);
+    REQUIRE(lookup(0xE3A1).id == opcode_id::OP_EXA1);
+    REQUIRE(lookup(0xF465).id == opcode_id::OP_FX65);
+  }
+  SECTION("Unrecognized opcodes") {
+    REQUIRE(lookup(0x0123).id == opcode_id::UNKNOWN);
+    REQUIRE(lookup(0x812F).id == opcode_id::UNKNOWN);
+    REQUIRE(lookup(0xE1FF).id == opcode_id::UNKNOWN);
+    REQUIRE(lookup(0xF1FF).id == opcode_id::UNKNOWN);
+  }
+}
+TEST_CASE("State view") {
+  chip8 emulator;
+  const auto &state = emulator.get_state();
+  std::vector<uint8_t> rom{0x61, 0x32, 0xA1, 0x23};
+
+  emulator.load_memory(rom);
+  emulator.step_one_cycle();
+  emulator.step_one_cycle();
+
+  // The view follows the emulator without being fetched again
+  REQUIRE(state.V[1] == 0x32);
+  REQUIRE(state.I == 0x123);
+  REQUIRE(state.prog_counter == 0x204);
+  REQUIRE(state.memory[0x200] == 0x61);
+  REQUIRE(&state.memory == &emulator.get_state().memory);
+}
+TEST_CASE("Instruction trace") {
+  chip8 emulator;
+  std::vector<uint8_t> rom{0x61, 0x32, 0xD1, 0x25};
+
+  emulator.load_memory(rom);
+  emulator.step_one_cycle();
+  emulator.step_one_cycle();
+
+  if constexpr (debug) {
+    REQUIRE(emulator.get_trace_size() == 2);
+    REQUIRE(emulator.get_trace(0).prog_counter == 0x202);
+    REQUIRE(emulator.get_trace(0).opcode == 0xD125);
+    REQUIRE(emulator.get_trace(1).opcode == 0x6132);
+    REQUIRE(last_instruction(emulator) == "DXYN: DRW 0x1, 0x2, 0x5");
+  } else {
+    REQUIRE(emulator.get_trace_size() == 0);
+    REQUIRE(last_instruction(emulator).empty());
+  }
+}
+TEST_CASE("Disassembler") {
+  SECTION("Single opcode into a caller buffer") {
+    std::array<char, disassembly_max_length> line{};
+    const auto length = disassemble(0x8125, line.data(), line.size());
+
+    REQUIRE(std::string(line.data()) == "8XY5: SUB 0x1, 0x2");
+    REQUIRE(length == 18);
+  }
+  SECTION("Prefixed with the address") {
+    std::array<char, disassembly_max_length> line{};
+    disassemble(0x202, 0x00EE, line.data(), line.size());
+
+    REQUIRE(std::string(line.data()) == "0x202  00EE: RET");
+  }
+  SECTION("Truncated to the buffer size") {
+    std::array<char, 8> line{};
+    const auto length = disassemble(0xA123, line.data(), line.size());
+
+    REQUIRE(std::string(line.data()) == "ANNN: L");
+    REQUIRE(length == 7);
+  }
+  SECTION("Whole range of a memory dump") {
+    chip8 emulator;
+    std::vector<uint8_t> rom{0x61, 0x32, 0x22, 0x06, 0xF1, 0x33};
+    emulator.load_memory(rom);
+    std::vector<std::string> lines;
+
+    disassemble_range(emulator.get_memory_dump(), 0x200, 0x206,
+                      [&lines](uint16_t /*pc*/, const char *text) {
+                        lines.emplace_back(text);
+                      });
+
+    REQUIRE(lines.size() == 3);
+    REQUIRE(lines[0] == "0x200  6XNN: LD 0x1, 0x32");
+    REQUIRE(lines[1] == "0x202  2NNN: CALL 0x206");
+    REQUIRE(lines[2] == "0x204  FX33: LD B, 0x1");
+  }
+}
+TEST_CASE("Triple buffer") {
+  triple_buffer<int> frames;
+  SECTION("The consumer sees the latest published value") {
+    REQUIRE_FALSE(frames.update());
+
+    frames.write_buffer() = 1;
+    frames.publish();
+    frames.write_buffer() = 2;
+    frames.publish();
+    REQUIRE(frames.update());
+    REQUIRE(frames.read_buffer() == 2);
+    REQUIRE_FALSE(frames.update());
+    REQUIRE(frames.read_buffer() == 2);
+  }
+  SECTION("Values arrive in order across threads") {
+    constexpr int last = 100000;
+    std::thread producer{[&frames] {
+      for (int value = 1; value <= last; ++value) {
+        frames.write_buffer() = value;
+        frames.publish();
+      }
+    }};
+    int seen = 0;
+    bool in_order = true;
+    while (seen != last) {
+      if (frames.update()) {
+        in_order = in_order && frames.read_buffer() > seen;
+        seen = frames.read_buffer();
+      }
+    }
+    producer.join();
+    REQUIRE(in_order);
+  }
+}
+TEST_CASE("Snapshots") {
+  // Calls, draws, random numbers and a timer, then loops
+  std::vector<uint8_t> rom{0x60, 0x20, 0xF0, 0x15, 0x22, 0x0A, 0x70, 0x01,
+                           0x12, 0x04, 0xC1, 0xFF, 0xF1, 0x29, 0xD0, 0x15,
+                           0x00, 0xEE};
+  chip8 emulator;
+  emulator.seed_rng(77);
+  emulator.load_memory(rom);
+  emulator.set_keys(0x0101);
+  emulator.run(123);
+  std::array<uint8_t, snapshot_size> blob{};
+
+  SECTION("Round trip through the binary blob") {
+    REQUIRE(emulator.save_state(blob.data(), blob.size()) == snapshot_size);
+    chip8 restored{backend::threaded};
+    restored.load_state(blob.data(), blob.size());
+    REQUIRE(restored.get_state().memory == emulator.get_state().memory);
+    REQUIRE(restored.get_state().display == emulator.get_state().display);
+    REQUIRE(restored.get_prog_counter() == emulator.get_prog_counter());
+
+    emulator.run(500);
+    restored.run(500);
+    require_same_state(emulator, restored);
+  }
+  SECTION("Restoring goes back in time") {
+    const auto snapshot = emulator.get_state();
+    emulator.run(500);
+    emulator.load_state(snapshot);
+    chip8 reference;
+    reference.load_state(snapshot);
+
+    emulator.run(500);
+    reference.run(500);
+    require_same_state(emulator, reference);
+  }
+  SECTION("Restored code is executed, not the cached one") {
+    auto patched = emulator.get_state();
+    // Turn the 7XNN in the loop into a 6XNN
+    patched.memory[prog_mem_begin + 6] = 0x60;
+    emulator.load_state(patched);
+    emulator.run(20);
+    REQUIRE(emulator.get_V_registers()[0] == 0x01);
+  }
+  SECTION("Foreign data is rejected") {
+    emulator.save_state(blob.data(), blob.size());
+    blob[0] = 0;
+    REQUIRE_THROWS_AS(emulator.load_state(blob.data(), blob.size()),
+                      std::invalid_argument);
+    REQUIRE_THROWS_AS(emulator.load_state(blob.data(), 10),
+                      std::invalid_argument);
+    REQUIRE_THROWS_AS(emulator.save_state(blob.data(), 10), std::length_error);
+  }
+  SECTION("reset goes back to power on") {
+    emulator.reset();
+    chip8 fresh;
+    fresh.seed_rng(77);
+    fresh.load_memory(rom);
+    require_same_state(emulator, fresh);
+  }
+}
+TEST_CASE("Rewind buffer") {
+  std::vector<uint8_t> rom{0x60, 0x20, 0xF0, 0x15, 0x22, 0x0A, 0x70, 0x01,
+                           0x12, 0x04, 0xC1, 0xFF, 0xF1, 0x29, 0xD0, 0x15,
+                           0x00, 0xEE};
+  chip8 emulator;
+  emulator.load_memory(rom);
+  std::vector<chip8_state> history;
+  for (int frame = 0; frame < 300; ++frame) {
+    emulator.run_frame();
+    history.push_back(emulator.get_state());
+  }
+  auto same = [](const chip8_state &lhs, const chip8_state &rhs) {
+    return lhs.memory == rhs.memory && lhs.display == rhs.display &&
+           lhs.V == rhs.V && lhs.I == rhs.I &&
+           lhs.prog_counter == rhs.prog_counter &&
+           lhs.hw_stack == rhs.hw_stack &&
+           lhs.stack_pointer == rhs.stack_pointer &&
+           lhs.delay_timer == rhs.delay_timer && lhs.rng == rhs.rng &&
+           lhs.timer_phase == rhs.timer_phase;
+  };
+
+  SECTION("Frames come back newest first") {
+    rewind_buffer rewind{1U << 20U, 1000, 30};
+    for (const auto &state : history) {
+      rewind.push(state);
+    }
+    REQUIRE(rewind.size() == history.size());
+    // Deltas are much smaller than whole snapshots
+    REQUIRE(rewind.bytes_used() < history.size() * sizeof(chip8_state) / 4);
+
+    chip8_state state{};
+    bool all_same = true;
+    for (auto frame = history.rbegin(); frame != history.rend(); ++frame) {
+      all_same = rewind.pop(state) && same(state, *frame) && all_same;
+    }
+    REQUIRE(all_same);
+    REQUIRE_FALSE(rewind.pop(state));
+  }
+  SECTION("The oldest frames are dropped once full") {
+    rewind_buffer rewind{3 * sizeof(chip8_state), 1000, 10};
+    for (const auto &state : history) {
+      rewind.push(state);
+    }
+    REQUIRE(rewind.size() < history.size());
+    REQUIRE(rewind.bytes_used() <= 3 * sizeof(chip8_state));
+
+    chip8_state state{};
+    bool all_same = true;
+    auto frame = history.rbegin();
+    while (rewind.pop(state)) {
+      all_same = same(state, *frame) && all_same;
+      ++frame;
+    }
+    REQUIRE(all_same);
+  }
+  SECTION("Pushing after stepping back continues from there") {
+    rewind_buffer rewind{1U << 20U, 50, 7};
+    for (const auto &state : history) {
+      rewind.push(state);
+    }
+    REQUIRE(rewind.size() <= 50);
+    chip8_state state{};
+    for (int step = 0; step < 12; ++step) {
+      REQUIRE(rewind.pop(state));
+    }
+    rewind.push(history.front());
+    chip8_state popped{};
+    REQUIRE(rewind.pop(popped));
+    REQUIRE(same(popped, history.front()));
+    REQUIRE(rewind.pop(popped));
+    REQUIRE(same(popped, history[history.size() - 13]));
+  }
+}
+
+TEST_CASE("Movies") {
+  // Waits for a key and mixes it with CXNN, so the run depends on both
+  std::vector<uint8_t> rom{0xC1, 0xFF, 0xF0, 0x0A, 0x80,
+                           0x14, 0x82, 0x04, 0x12, 0x00};
+  const auto file_name =
+      (std::filesystem::temp_directory_path() / "tests-chip8.c8mv").string();
+  auto keys_of = [](int frame) -> uint16_t {
+    return static_cast<uint16_t>((frame / 7 % 3 == 0) ? 0U
+                                                      : 1U << (frame % 16));
+  };
+  constexpr int frames = 3000;
+
+  chip8 recorded;
+  recorded.load_memory(rom);
+  recorded.seed_rng(1234);
+  {
+    movie_header header;
+    header.seed = 1234;
+    header.rom_hash = rom_hash(recorded.get_state());
+    movie_writer movie{file_name, header};
+    for (int frame = 0; frame < frames; ++frame) {
+      movie.record(keys_of(frame));
+      recorded.set_keys(keys_of(frame));
+      recorded.run_frame();
+    }
+  }
+
+  SECTION("Keys come back frame by frame") {
+    movie_reader movie{file_name};
+    REQUIRE(movie.header().seed == 1234);
+    REQUIRE(movie.header().clock_hz == default_clock_hz);
+    uint16_t keys = 0;
+    bool all_same = true;
+    for (int frame = 0; frame < frames; ++frame) {
+      all_same = movie.next(keys) && keys == keys_of(frame) && all_same;
+    }
+    REQUIRE(all_same);
+    REQUIRE_FALSE(movie.next(keys));
+  }
+  SECTION("Replaying reproduces the run") {
+    chip8 replayed;
+    replayed.load_memory(rom);
+    movie_reader movie{file_name};
+    REQUIRE(movie.header().rom_hash == rom_hash(replayed.get_state()));
+    replayed.seed_rng(movie.header().seed);
+    replayed.set_clock_hz(movie.header().clock_hz);
+    uint16_t keys = 0;
+    while (movie.next(keys)) {
+      replayed.set_keys(keys);
+      replayed.run_frame();
+    }
+    REQUIRE(replayed.get_state().V == recorded.get_state().V);
+    REQUIRE(replayed.get_state().rng == recorded.get_state().rng);
+    REQUIRE(replayed.get_state().prog_counter ==
+            recorded.get_state().prog_counter);
+  }
+  SECTION("Other files are refused") {
+    REQUIRE_THROWS_AS(movie_reader{"no_such_movie.c8mv"},
+                      std::invalid_argument);
+    std::ofstream{file_name} << "not a movie";
+    REQUIRE_THROWS_AS(movie_reader{file_name}, std::invalid_argument);
+  }
+  std::filesystem::remove(file_name);
+}
+
+TEST_CASE("Instance pool") {
+  // Draws random sprites forever
+  const std::vector<uint8_t> busy_rom{0xC0, 0x3F, 0xC1, 0x1F, 0xF2, 0x29,
+                                      0xD0, 0x15, 0x12, 0x00};
+  // Returns without a call on its first instruction
+  const std::vector<uint8_t> faulting_rom{0x00, 0xEE};
+  constexpr std::size_t instances = 64;
+  constexpr std::size_t frames = 50;
+  chip8_pool pool{instances, backend::interpreter, 4};
+  REQUIRE(pool.size() == instances);
+  REQUIRE(pool.worker_count() == 4);
+  for (std::size_t i = 0; i < instances; ++i) {
+    pool.instance(i).load_memory((i % 8 == 7) ? faulting_rom : busy_rom);
+    pool.instance(i).seed_rng(static_cast<uint32_t>(i + 1));
+  }
+  pool.run_frames(frames);
+
+  bool all_match = true;
+  for (std::size_t i = 0; i < instances; ++i) {
+    chip8 alone;
+    alone.load_memory((i % 8 == 7) ? faulting_rom : busy_rom);
+    alone.seed_rng(static_cast<uint32_t>(i + 1));
+    std::size_t alone_frames = 0;
+    while (alone_frames < frames && alone.get_fault() == fault::none) {
+      alone.run_frame();
+      ++alone_frames;
+    }
+    const auto &result = pool.result(i);
+    all_match = result.frames == alone_frames &&
+                result.error == alone.get_fault() &&
+                pool.instance(i).get_state().display ==
+                    alone.get_state().display &&
+                all_match;
+  }
+  REQUIRE(all_match);
+  REQUIRE(pool.result(7).frames == 1);
+  REQUIRE(pool.result(7).error == fault::stack_underflow);
+  REQUIRE(pool.result(0).frames == frames);
+
+  // A faulted slot runs again once it gets a new ROM
+  pool.instance(7).load_memory(busy_rom);
+  pool.run_frames(1);
+  REQUIRE(pool.result(7).frames == 2);
+  REQUIRE(pool.result(7).error == fault::none);
+}
+
+// Everything the lockstep lanes keep per lane
+static bool same(const chip8_state &lhs, const chip8_state &rhs) {
+  return lhs.memory == rhs.memory && lhs.display == rhs.display &&
+         lhs.V == rhs.V && lhs.I == rhs.I &&
+         lhs.prog_counter == rhs.prog_counter &&
+         lhs.hw_stack == rhs.hw_stack &&
+         lhs.stack_pointer == rhs.stack_pointer &&
+         lhs.delay_timer == rhs.delay_timer &&
+         lhs.sound_timer == rhs.sound_timer && lhs.rng == rhs.rng &&
+         lhs.timer_phase == rhs.timer_phase && lhs.keys == rhs.keys &&
+         lhs.error == rhs.error;
+}
+
+TEST_CASE("Lockstep lanes match separate machines") {
+  // Branches, calls and draws depending on CXNN and the keys, so lanes
+  // with different seeds split up and meet again
+  const std::vector<uint8_t> rom{
+      0x63, 0x05, 0xC1, 0x07, 0x41, 0x00, 0x22, 0x20, 0x81, 0x14, 0x83,
+      0x16, 0xA3, 0x00, 0xF3, 0x33, 0xF2, 0x65, 0xF0, 0x29, 0xD1, 0x25,
+      0xE1, 0x9E, 0xF1, 0x15, 0xF4, 0x07, 0x12, 0x02, 0x00, 0x00, 0x72,
+      0x01, 0x81, 0x24, 0x00, 0xEE};
+  constexpr std::size_t lanes = 8;
+  constexpr std::size_t cycles = 3000;
+  auto lockstep = std::make_unique<lockstep_chip8<lanes>>();
+  lockstep->load_memory(rom);
+
+  SECTION("Lanes with the same input never split") {
+    lockstep->run(cycles);
+    chip8 alone;
+    alone.load_memory(rom);
+    alone.run(cycles);
+    REQUIRE(lockstep->get_dispatch_count() == cycles);
+    REQUIRE(same(lockstep->get_state(lanes - 1), alone.get_state()));
+  }
+  SECTION("Diverging lanes give the same results") {
+    for (std::size_t lane = 0; lane < lanes; ++lane) {
+      lockstep->seed_rng(lane, static_cast<uint32_t>(lane * 7919 + 1));
+      lockstep->set_keys(lane, static_cast<uint16_t>(lane * 0x1111));
+    }
+    lockstep->run(cycles);
+    REQUIRE(lockstep->get_dispatch_count() > cycles);
+
+    bool all_same = true;
+    for (std::size_t lane = 0; lane < lanes; ++lane) {
+      chip8 alone;
+      alone.load_memory(rom);
+      alone.seed_rng(static_cast<uint32_t>(lane * 7919 + 1));
+      alone.set_keys(static_cast<uint16_t>(lane * 0x1111));
+      alone.run(cycles);
+      all_same = same(lockstep->get_state(lane), alone.get_state()) &&
+                 all_same;
+    }
+    REQUIRE(all_same);
+  }
+  SECTION("Memory accesses wrap at 0xFFF like chip8") {
+    // BCD, FX55 and FX65 across the end of memory, then a jump to 0xFFF
+    // whose opcode ends with the byte stored at 0
+    const std::vector<uint8_t> top_rom{
+        0x63, 0xFB, 0xAF, 0xFE, 0xF3, 0x33, 0x60, 0x11, 0x61, 0x22,
+        0x62, 0x60, 0xAF, 0xFD, 0xF2, 0x55, 0xF0, 0x65, 0xAF, 0xFE,
+        0xF1, 0x65, 0x1F, 0xFF};
+    lockstep->load_memory(top_rom);
+    std::vector<chip8> machines;
+    machines.emplace_back(backend::interpreter);
+    machines.emplace_back(backend::threaded);
+    bool all_same = true;
+    for (auto &alone : machines) {
+      alone.load_memory(top_rom);
+    }
+    for (std::size_t cycle = 0; cycle < 14; ++cycle) {
+      lockstep->run(1);
+      for (auto &alone : machines) {
+        alone.run(1);
+        all_same = same(lockstep->get_state(0), alone.get_state()) &&
+                   all_same;
+      }
+    }
+    REQUIRE(all_same);
+    const auto &state = machines[0].get_state();
+    REQUIRE(state.memory[0xFFD] == 0x11);
+    REQUIRE(state.memory[0xFFF] == 0x60);
+    REQUIRE(state.memory[0x000] == 0x01);
+    // 0x6001 ran from 0xFFF
+    REQUIRE(state.V[0] == 0x01);
+    REQUIRE(state.V[1] == 0x60);
+  }
+  SECTION("A faulting lane halts on its own") {
+    chip8 faulty;
+    faulty.load_memory(std::vector<uint8_t>{0x00, 0xEE});
+    lockstep->load_state(3, faulty.get_state());
+    lockstep->run(10);
+    REQUIRE(lockstep->get_fault(3) == fault::stack_underflow);
+    REQUIRE(lockstep->get_state(3).prog_counter == prog_mem_begin);
+    REQUIRE(lockstep->get_fault(2) == fault::none);
+    REQUIRE_THROWS_AS(lockstep->get_state(lanes), std::out_of_range);
+  }
+}
+
+// Random programs run into unknown opcodes, which both engines report on
+// stderr. Keeps those reports out of the test output while in scope
+class quiet_stderr {
+public:
+  quiet_stderr() : saved{dup(STDERR_FILENO)} {
+    std::fflush(stderr);
+    const int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDERR_FILENO);
+    close(null);
+  }
+  ~quiet_stderr() {
+    std::fflush(stderr);
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+  }
+  quiet_stderr(const quiet_stderr &) = delete;
+  quiet_stderr &operator=(const quiet_stderr &) = delete;
+
+private:
+  int saved;
+};
+
+// A program of random instructions from every opcode family. Jumps, calls
+// and ANNN point into the program, odd addresses included, so execution
+// also runs through misaligned words and FX33/FX55 rewrite the code
+static std::vector<uint8_t> random_rom(std::mt19937 &random) {
+  constexpr std::array<uint16_t, 34> opcodes{
+      0x00E0, 0x00EE, 0x1000, 0x2000, 0x3000, 0x4000, 0x5000,
+      0x6000, 0x7000, 0x8000, 0x8001, 0x8002, 0x8003, 0x8004,
+      0x8005, 0x8006, 0x8007, 0x800E, 0x9000, 0xA000, 0xB000,
+      0xC000, 0xD000, 0xE09E, 0xE0A1, 0xF007, 0xF00A, 0xF015,
+      0xF018, 0xF01E, 0xF029, 0xF033, 0xF055, 0xF065};
+  // Random operand bits by first nibble, 0 where NNN is an address
+  constexpr std::array<uint16_t, 16> operands{
+      0x0000, 0x0000, 0x0000, 0x0FFF, 0x0FFF, 0x0FF0, 0x0FFF, 0x0FFF,
+      0x0FF0, 0x0FF0, 0x0000, 0x0000, 0x0FFF, 0x0FFF, 0x0F00, 0x0F00};
+  const auto length = 8 + random() % 57;
+  std::vector<uint8_t> rom;
+  for (std::size_t i = 0; i < length; ++i) {
+    auto opcode = opcodes[random() % opcodes.size()];
+    const auto family = static_cast<std::size_t>(opcode >> 12U);
+    if (family == 0x1 || family == 0x2 || family == 0xA || family == 0xB) {
+      opcode = static_cast<uint16_t>(
+          opcode | (prog_mem_begin + random() % (length * 2)));
+    } else {
+      opcode = static_cast<uint16_t>(opcode | (random() & operands[family]));
+    }
+    rom.push_back(static_cast<uint8_t>(opcode >> 8U));
+    rom.push_back(static_cast<uint8_t>(opcode & 0xFFU));
+  }
+  return rom;
+}
+
+TEST_CASE("Lockstep lanes match chip8 on random programs") {
+  constexpr std::size_t lanes = 8;
+  constexpr std::size_t programs = 200;
+  constexpr std::size_t checks = 20;
+  constexpr std::size_t cycles = 50;
+  std::mt19937 random{8};
+  auto lockstep = std::make_unique<lockstep_chip8<lanes>>();
+  std::string mismatch;
+  std::size_t rewritten = 0;
+  {
+    const quiet_stderr quiet;
+    for (std::size_t program = 0; program < programs && mismatch.empty();
+         ++program) {
+      const auto rom = random_rom(random);
+      lockstep->load_memory(rom);
+      std::vector<chip8> machines;
+      for (std::size_t lane = 0; lane < lanes; ++lane) {
+        // Both backends, the threaded one has to notice rewritten code
+        machines.emplace_back(lane % 2 == 0 ? backend::interpreter
+                                            : backend::threaded);
+        const auto seed = static_cast<uint32_t>(random());
+        const auto keys = static_cast<uint16_t>(random());
+        machines[lane].load_memory(rom);
+        machines[lane].seed_rng(seed);
+        machines[lane].set_keys(keys);
+        lockstep->seed_rng(lane, seed);
+        lockstep->set_keys(lane, keys);
+      }
+      for (std::size_t check = 0; check < checks && mismatch.empty();
+           ++check) {
+        lockstep->run(cycles);
+        for (std::size_t lane = 0; lane < lanes; ++lane) {
+          machines[lane].run(cycles);
+          if (!same(lockstep->get_state(lane), machines[lane].get_state())) {
+            std::ostringstream where;
+            where << "program " << program << ", lane " << lane
+                  << ", after " << (check + 1) * cycles << " cycles";
+            mismatch = where.str();
+            break;
+          }
+        }
+      }
+      const auto &memory = machines[0].get_state().memory;
+      rewritten += !std::equal(rom.begin(), rom.end(),
+                               memory.begin() + prog_mem_begin);
+    }
+  }
+  INFO(mismatch);
+  REQUIRE(mismatch.empty());
+  // The programs did exercise self-modifying code
+  REQUIRE(rewritten > 0);
+}
+
+TEST_CASE("ROM size limits and the ROM store") {
+  const auto directory = std::filesystem::temp_directory_path();
+  auto write_rom = [&](const std::string &name,
+                       const std::vector<uint8_t> &bytes) {
+    const auto path = (directory / name).string();
+    std::ofstream file{path, std::ios::binary};
+    file.write(reinterpret_cast<const char *>(bytes.data()),
+               static_cast<std::streamsize>(bytes.size()));
+    return path;
+  };
+  const std::vector<uint8_t> pong{0x60, 0x01, 0x12, 0x00};
+  const std::vector<uint8_t> other{0x61, 0x02, 0x12, 0x00};
+  const std::vector<uint8_t> largest(max_rom_size, 0xAB);
+  const std::vector<uint8_t> too_large(max_rom_size + 1, 0xAB);
+  const auto pong_path = write_rom("tests-chip8-a.ch8", pong);
+  const auto copy_path = write_rom("tests-chip8-b.ch8", pong);
+  const auto other_path = write_rom("tests-chip8-c.ch8", other);
+  const auto large_path = write_rom("tests-chip8-d.ch8", too_large);
+  const auto empty_path = write_rom("tests-chip8-e.ch8", {});
+
+  SECTION("ROMs larger than program memory are refused") {
+    chip8 emulator;
+    REQUIRE_NOTHROW(emulator.load_memory(largest));
+    REQUIRE(emulator.get_state().memory.back() == 0xAB);
+    REQUIRE_THROWS_AS(emulator.load_memory(too_large), std::length_error);
+    REQUIRE_THROWS_AS(emulator.load_memory(large_path), std::length_error);
+  }
+  SECTION("Identical ROMs share one image") {
+    rom_store store;
+    const auto first = store.add_file(pong_path);
+    const auto copy = store.add_file(copy_path);
+    const auto different = store.add_file(other_path);
+    REQUIRE(store.size() == 3);
+    REQUIRE(store.unique_count() == 2);
+    REQUIRE(store.get(first).data == store.get(copy).data);
+    REQUIRE(store.get(first).hash != store.get(different).hash);
+    REQUIRE(store.get(different).size == other.size());
+
+    chip8 emulator;
+    store.load(different, emulator);
+    REQUIRE(std::equal(other.begin(), other.end(),
+                       emulator.get_state().memory.begin() + prog_mem_begin));
+    emulator.run(1);
+    REQUIRE(emulator.get_state().V[1] == 0x02);
+
+    // reset() reads the image in the store again
+    emulator.reset();
+    REQUIRE(emulator.get_state().V[1] == 0x00);
+    REQUIRE(std::equal(other.begin(), other.end(),
+                       emulator.get_state().memory.begin() + prog_mem_begin));
+    // and a copied ROM replaces it
+    emulator.load_memory(pong);
+    emulator.reset();
+    REQUIRE(std::equal(pong.begin(), pong.end(),
+                       emulator.get_state().memory.begin() + prog_mem_begin));
+  }
+  SECTION("Bad files are refused") {
+    rom_store store;
+    REQUIRE_THROWS_AS(store.add_file(large_path), std::length_error);
+    REQUIRE_THROWS_AS(store.add_file(empty_path), std::length_error);
+    REQUIRE_THROWS_AS(store.add_file("no_such_rom.ch8"),
+                      std::invalid_argument);
+    REQUIRE(store.size() == 0);
+  }
+  for (const auto &path :
+       {pong_path, copy_path, other_path, large_path, empty_path}) {
+    std::filesystem::remove(path);
+  }
+}
+
+TEST_CASE("ROM archives") {
+  const auto directory = std::filesystem::temp_directory_path();
+  const auto path = (directory / "tests-chip8.c8pk").string();
+  const std::vector<uint8_t> pong{0x60, 0x01, 0x12, 0x00};
+  const std::vector<uint8_t> other{0x61, 0x02, 0x12, 0x00};
+  write_archive(path, {{"pong", pong, 0, 0},
+                       {"pong copy", pong, 0, 0},
+                       {"other", other, 1000, 1}});
+  // The copy of pong is stored once
+  const auto file_size = std::filesystem::file_size(path);
+  REQUIRE(file_size == sizeof(archive_header) + 3 * sizeof(archive_entry) +
+                           4 + 9 + 5 + pong.size() + other.size());
+
+  SECTION("Every ROM is added with its name and clock") {
+    rom_store store;
+    const auto first = store.add_archive(path);
+    REQUIRE(first == 0);
+    REQUIRE(store.size() == 3);
+    REQUIRE(store.unique_count() == 2);
+    REQUIRE(store.info(1).name == "pong copy");
+    REQUIRE(store.info(2).clock_hz == 1000);
+    REQUIRE(store.info(2).quirks == 1);
+    REQUIRE(store.get(0).data == store.get(1).data);
+
+    chip8 emulator;
+    store.load(2, emulator);
+    emulator.run(1);
+    REQUIRE(emulator.get_state().V[1] == 0x02);
+    // Nothing new in a second copy of the archive
+    REQUIRE(store.add_archive(path) == 3);
+    REQUIRE(store.unique_count() == 2);
+  }
+  SECTION("Damaged archives are refused") {
+    rom_store store;
+    std::vector<char> bytes(file_size);
+    std::ifstream{path, std::ios::binary}.read(
+        bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    auto rewrite = [&](std::size_t size) {
+      std::ofstream{path, std::ios::binary | std::ios::trunc}.write(
+          bytes.data(), static_cast<std::streamsize>(size));
+    };
+    rewrite(sizeof(archive_header) + sizeof(archive_entry));
+    REQUIRE_THROWS_AS(store.add_archive(path), std::invalid_argument);
+    // The last byte belongs to the other ROM
+    bytes.back() = static_cast<char>(~bytes.back());
+    rewrite(bytes.size());
+    REQUIRE_THROWS_AS(store.add_archive(path), std::invalid_argument);
+    REQUIRE(store.size() == 0);
+    REQUIRE(store.unique_count() == 0);
+  }
+  SECTION("Empty ROMs are not packed") {
+    REQUIRE_THROWS_AS(write_archive(path, {{"empty", {}, 0, 0}}),
+                      std::length_error);
+  }
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("Profiling counters") {
+  // Draws the 0 glyph at (1, 1), polls key 1 and spins at 0x208
+  const std::vector<uint8_t> rom{0x60, 0x01, 0xA0, 0x00, 0xD0, 0x05,
+                                 0xE0, 0x9E, 0x12, 0x08};
+  for (const auto engine : {backend::interpreter, backend::threaded}) {
+    chip8 emulator{engine};
+    emulator.load_memory(rom);
+    // Two frames of 10 instructions at the default clock
+    emulator.run_frame();
+    emulator.run_frame();
+    const auto &profile = emulator.get_profile();
+    auto opcode = [&profile](opcode_id id) {
+      return profile.opcodes[static_cast<std::size_t>(id)];
+    };
+    if constexpr (profiling) {
+      REQUIRE(opcode(opcode_id::OP_DXYN) == 1);
+      REQUIRE(opcode(opcode_id::OP_EX9E) == 1);
+      REQUIRE(opcode(opcode_id::OP_1NNN) == 16);
+      REQUIRE(profile.prog_counters[0x208] == 16);
+      REQUIRE(profile.sprite_pixels == 40);
+      REQUIRE(profile.key_polls == 1);
+      REQUIRE(profile.frame_instructions[frame_bucket(10)] == 2);
+    } else {
+      REQUIRE(opcode(opcode_id::OP_1NNN) == 0);
+      REQUIRE(profile.prog_counters[0x208] == 0);
+    }
+    emulator.reset_profile();
+    REQUIRE(emulator.get_profile().key_polls == 0);
+  }
+
+  SECTION("Exports") {
+    chip8_profile profile;
+    profile.opcodes[static_cast<std::size_t>(opcode_id::OP_DXYN)] = 3;
+    profile.prog_counters[0x200] = 3;
+    profile.frame_instructions[frame_bucket(10)] = 2;
+    std::ostringstream csv;
+    write_profile_csv(csv, profile);
+    REQUIRE(csv.str().find("opcode,DXYN,3\n") != std::string::npos);
+    REQUIRE(csv.str().find("prog_counter,512,3\n") != std::string::npos);
+    REQUIRE(csv.str().find("frame_instructions,8,2\n") != std::string::npos);
+    REQUIRE(csv.str().find("prog_counter,513") == std::string::npos);
+    std::ostringstream json;
+    write_profile_json(json, profile);
+    REQUIRE(json.str().find("\"DXYN\": 3") != std::string::npos);
+    REQUIRE(json.str().find("{\"min\": 8, \"frames\": 2}") !=
+            std::string::npos);
+  }
+}